@@ -0,0 +1,104 @@
+#ifndef IMAGE_COMPRESSION_THREAD_SCALING_BENCHMARK_H
+#define IMAGE_COMPRESSION_THREAD_SCALING_BENCHMARK_H
+
+#include "../core/ImageCompressor.h"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace ImageCompression {
+
+    // What to benchmark and how hard
+    struct BenchmarkConfig {
+        std::string inputDirectory;   // The fixed corpus - every PNG in here
+        PruningConfig pruningConfig;
+        unsigned int maxThreads;      // Highest thread count to try (0 = one per hardware thread)
+        int repetitions;              // Each measurement is the best of this many runs
+        std::string csvPath;          // Where to write the CSV too (empty = don't)
+        
+        BenchmarkConfig(const std::string& directory, const PruningConfig& config,
+                        unsigned int threads = 0, int runs = 3)
+            : inputDirectory(directory), pruningConfig(config), maxThreads(threads), repetitions(runs) {}
+    };
+
+    // Best time for one stage (or the whole batch) at one thread count
+    struct ScalingSample {
+        std::string stage;
+        unsigned int threads;
+        double seconds;
+        double speedup;      // Time at 1 thread / time at this many
+        double efficiency;   // Speedup / threads - 1.0 is perfect scaling
+    };
+
+    // Heap allocations one tree build made once the node pools and workers were warmed up
+    // (the most any image needed) - anything but 0 means the build went back to the heap
+    struct AllocationSample {
+        unsigned int threads;
+        size_t allocations;
+    };
+
+    // FastHash throughput over the encoded corpus at one thread count, every thread hashing
+    // its own images the way cache lookups in batch mode do
+    struct HashThroughputSample {
+        unsigned int threads;
+        double gigabytesPerSecond;
+    };
+
+    // Runs the same corpus at 1, 2, 4, ... N threads so we can see where adding threads
+    // stops paying off. The parallel stages (statistics, tree build, render) are timed one
+    // image at a time, so they show the scaling inside an image; end-to-end compresses the
+    // whole corpus the way batch mode does, images and their stages sharing the threads.
+    // The hash row is FastHash over the encoded corpus, which is what cache keys cost.
+    class ThreadScalingBenchmark {
+    public:
+        explicit ThreadScalingBenchmark(const BenchmarkConfig& config);
+        
+        // Load the corpus, measure everything and return the samples
+        // Throws if the directory has no PNGs
+        std::vector<ScalingSample> run();
+        
+        // Tree-build allocation counts from the last run(), one per thread count
+        const std::vector<AllocationSample>& treeBuildAllocations() const { return allocationSamples_; }
+        
+        // Hash throughput from the last run(), one per thread count
+        const std::vector<HashThroughputSample>& hashThroughput() const { return hashSamples_; }
+        
+        // Speedup and efficiency tables, one row per stage and one column per thread count
+        static void printTables(const std::vector<ScalingSample>& samples, std::ostream& out);
+        
+        // stage,threads,seconds,speedup,efficiency - one line per sample
+        static void writeCsv(const std::vector<ScalingSample>& samples, std::ostream& out);
+        
+        // 1, 2, 4, ... up to maxThreads, always ending on maxThreads itself
+        static std::vector<unsigned int> threadCounts(unsigned int maxThreads);
+
+    private:
+        BenchmarkConfig config_;
+        std::vector<std::vector<uint8_t>> corpus_;   // Encoded PNGs, loaded once so disk time stays out of it
+        std::vector<AllocationSample> allocationSamples_;
+        std::vector<HashThroughputSample> hashSamples_;
+        
+        // Each hash measurement covers at least this much data, however small the corpus
+        static constexpr size_t HASH_MINIMUM_BYTES = 256u << 20;
+        
+        void loadCorpus();
+        
+        // Every image one after another - returns the best per-stage times
+        StageMetrics measureStages();
+        
+        // The whole corpus as one batch, like batch mode runs it - returns the best wall time
+        double measureEndToEnd();
+        
+        // Hash the corpus over and over (at least HASH_MINIMUM_BYTES) with every image a task -
+        // returns the best wall time and the bytes hashed in it
+        double measureHash(size_t& bytesHashed);
+        
+        // Build every image's tree a few times over from the same statistics and count
+        // heap allocations - returns the most any one build made after the first
+        size_t measureTreeBuildAllocations();
+    };
+
+} // namespace ImageCompression
+
+#endif // IMAGE_COMPRESSION_THREAD_SCALING_BENCHMARK_H 
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef IMAGE_COMPRESSION_RESULT_CACHE_H
+#define IMAGE_COMPRESSION_RESULT_CACHE_H
+
+#include "../core/AdaptiveImageTree.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ImageCompression {
+
+    // What we remember about a cached result besides the PNG itself
+    struct CachedResultInfo {
+        double compressionRatio = 0.0;
+        size_t originalPixels = 0;
+        size_t compressedRegions = 0;
+        double processingTimeSeconds = 0.0;   // How long the original compression took
+    };
+
+    // On-disk cache of compressed outputs, so re-running a batch over the same inputs
+    // skips decoding and tree building entirely.
+    //
+    // Entries are keyed on a hash of the raw input file bytes plus the settings and
+    // algorithm version, so any change to either misses instead of returning stale output.
+    // Each entry is one file: a short text header with the result numbers, then the PNG.
+    //
+    // Safe to share between processes and threads: entries are written to a temporary
+    // file and renamed into place, so readers only ever see complete entries. When the
+    // directory grows past its size limit, the least recently used entries go first
+    // (hits refresh an entry's modification time).
+    class ResultCache {
+    public:
+        static constexpr uint64_t DEFAULT_MAX_BYTES = 1024ull * 1024 * 1024;   // 1 GiB
+        
+        // Creates the directory if it doesn't exist yet
+        explicit ResultCache(const std::string& directory, uint64_t maxBytes = DEFAULT_MAX_BYTES);
+        
+        // Work out the key for some input bytes compressed with these settings
+        static std::string makeKey(const uint8_t* inputBytes, size_t size, const PruningConfig& config);
+        
+        // Look up an entry - fills in the PNG bytes and numbers and returns true on a hit
+        // An entry whose header doesn't match the rest of the file is a miss, and gets deleted
+        bool lookup(const std::string& key, std::vector<uint8_t>& pngBytes, CachedResultInfo& info) const;
+        
+        // Add an entry, then trim the cache back under its size limit if needed
+        // Failing to write the cache never fails the compression, so errors are swallowed
+        void store(const std::string& key, const std::vector<uint8_t>& pngBytes, const CachedResultInfo& info);
+        
+        // Delete least recently used entries until the cache fits in its size limit
+        void evictToLimit();
+        
+        const std::string& getDirectory() const { return directory_; }
+        uint64_t getMaxBytes() const { return maxBytes_; }
+
+    private:
+        // Bump when the entry file layout changes
+        static constexpr int ENTRY_FORMAT_VERSION = 1;
+        
+        std::string directory_;
+        uint64_t maxBytes_;
+        
+        std::string entryPath(const std::string& key) const;
+    };
+
+} // namespace ImageCompression
+
+#endif // IMAGE_COMPRESSION_RESULT_CACHE_H 
\ No newline at end of file
@@ -0,0 +1,144 @@
+/**
+ * @file caic.h
+ * @brief C API for embedding the content-aware image compressor in-process
+ *
+ * Build with `make lib` to get libcaic.so and libcaic.a. Everything goes through
+ * an opaque context that owns its working buffers, so keeping one context per
+ * thread and reusing it across images avoids re-allocating and re-faulting the
+ * large statistics tables on every call.
+ *
+ * A context must not be used by two threads at once. Different contexts can be
+ * used concurrently. No C++ exception ever crosses this API: failures come back
+ * as a caic_status, with details from caic_last_error().
+ */
+
+#ifndef CAIC_H
+#define CAIC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define CAIC_API __attribute__((visibility("default")))
+#else
+#define CAIC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Bumped whenever the API or ABI changes incompatibly */
+#define CAIC_API_VERSION 1
+
+/** @brief Opaque compression context */
+typedef struct caic_context caic_context;
+
+/** @brief Result of every call that can fail */
+typedef enum caic_status {
+    CAIC_OK = 0,                    /**< Success */
+    CAIC_ERROR_INVALID_ARGUMENT,    /**< Null pointer, zero size, mismatched dimensions, ... */
+    CAIC_ERROR_DECODE,              /**< Input bytes are not a valid PNG */
+    CAIC_ERROR_ENCODE,              /**< Result could not be encoded as PNG */
+    CAIC_ERROR_OUT_OF_MEMORY,       /**< An allocation failed */
+    CAIC_ERROR_INTERNAL             /**< Anything else - see caic_last_error() */
+} caic_status;
+
+/** @brief Byte layout of raw pixels (8 bits per channel) */
+typedef enum caic_pixel_format {
+    CAIC_FORMAT_RGBA8 = 0,          /**< Red, green, blue, alpha */
+    CAIC_FORMAT_RGB8,               /**< Red, green, blue - treated as opaque */
+    CAIC_FORMAT_BGRA8               /**< Blue, green, red, alpha */
+} caic_pixel_format;
+
+/** @brief Numbers from the most recent successful compression */
+typedef struct caic_stats {
+    double compression_ratio;       /**< Regions per original pixel (lower = more compressed) */
+    uint64_t original_pixels;       /**< Width * height */
+    uint64_t compressed_regions;    /**< Flat-colored regions in the result */
+    double processing_seconds;      /**< Time spent compressing (excludes PNG decode/encode) */
+} caic_stats;
+
+/**
+ * @brief Create a context
+ * @param quality Compression quality from 0.0 (smallest) to 1.0 (best looking); clamped
+ * @return New context, or NULL if out of memory
+ */
+CAIC_API caic_context* caic_create(double quality);
+
+/**
+ * @brief Destroy a context and every buffer it owns (NULL is ignored)
+ * @param context Context to destroy
+ */
+CAIC_API void caic_destroy(caic_context* context);
+
+/**
+ * @brief Change the quality used by later calls
+ * @param context Context to update
+ * @param quality 0.0 to 1.0; clamped
+ * @return CAIC_OK, or CAIC_ERROR_INVALID_ARGUMENT for a NULL context
+ */
+CAIC_API caic_status caic_set_quality(caic_context* context, double quality);
+
+/**
+ * @brief Compress an encoded PNG held in memory
+ *
+ * The result is written to a buffer owned by the context. It stays valid until the
+ * next compress call on the same context or caic_destroy().
+ *
+ * @param context Context to use
+ * @param input PNG file contents
+ * @param input_size Number of bytes in input
+ * @param output Receives a pointer to the compressed PNG bytes
+ * @param output_size Receives the number of bytes at *output
+ * @return CAIC_OK on success
+ */
+CAIC_API caic_status caic_compress_png(caic_context* context,
+                                       const uint8_t* input, size_t input_size,
+                                       const uint8_t** output, size_t* output_size);
+
+/**
+ * @brief Compress raw pixels into a caller-provided buffer of the same size
+ * @param context Context to use
+ * @param input First byte of the top-left input pixel
+ * @param width Width in pixels
+ * @param height Height in pixels
+ * @param input_stride Bytes between input rows (0 = tightly packed)
+ * @param input_format Byte layout of the input
+ * @param output First byte of the top-left output pixel (may be the same buffer as input)
+ * @param output_stride Bytes between output rows (0 = tightly packed)
+ * @param output_format Byte layout to write
+ * @return CAIC_OK on success
+ */
+CAIC_API caic_status caic_compress_pixels(caic_context* context,
+                                          const uint8_t* input, uint32_t width, uint32_t height,
+                                          size_t input_stride, caic_pixel_format input_format,
+                                          uint8_t* output, size_t output_stride,
+                                          caic_pixel_format output_format);
+
+/**
+ * @brief Get the numbers from the last successful compression on this context
+ * @param context Context to query
+ * @param stats Receives the numbers (all zero before the first success)
+ * @return CAIC_OK, or CAIC_ERROR_INVALID_ARGUMENT for NULL arguments
+ */
+CAIC_API caic_status caic_get_stats(const caic_context* context, caic_stats* stats);
+
+/**
+ * @brief Describe the last failure on this context
+ * @param context Context to query
+ * @return Message owned by the context ("" if the last call succeeded)
+ */
+CAIC_API const char* caic_last_error(const caic_context* context);
+
+/**
+ * @brief Get the API version the library was built with
+ * @return CAIC_API_VERSION of the library
+ */
+CAIC_API int caic_api_version(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAIC_H */
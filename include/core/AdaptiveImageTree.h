@@ -3,20 +3,50 @@
 
 #include "../utils/image/PNG.h"
 #include "../utils/image/HSLAPixel.h"
+#include "../utils/image/ImageView.h"
 #include "../statistics/ImageStatistics.h"
 #include <memory>
 #include <utility>
+#include <vector>
 
 namespace ImageCompression {
 
+    class SquaredErrorTable;
+
     // Settings that control how aggressively we compress the image
     struct PruningConfig {
         double minimumSimilarityPercentage;  // How similar colors need to be to merge regions
         double colorToleranceThreshold;      // How close colors need to be to count as "similar"
+        bool mergeAdjacentRegions;           // Also merge matching neighbours that live in different branches (off by default)
+        double mergeColorTolerance;          // Widest color spread a merged group may have - measured in
+                                             // chroma/luminance/alpha, so not comparable to colorToleranceThreshold
         
-        PruningConfig(double minSimilarity = 0.95, double tolerance = 0.1)
+        PruningConfig(double minSimilarity = 0.95, double tolerance = 0.1, bool mergeRegions = false,
+                      double mergeTolerance = 0.05)
             : minimumSimilarityPercentage(minSimilarity)
-            , colorToleranceThreshold(tolerance) {}
+            , colorToleranceThreshold(tolerance)
+            , mergeAdjacentRegions(mergeRegions)
+            , mergeColorTolerance(mergeTolerance) {}
+    };
+
+    // Settings for how the tree gets built (PruningConfig covers what happens afterwards)
+    struct BuildConfig {
+        double timeBudgetSeconds;     // Stop refining after this long and keep what we have (0 = no limit)
+        size_t maxRegions;            // Stop refining once there are this many regions (0 = no limit)
+        
+        BuildConfig(double timeBudget = 0.0, size_t regions = 0)
+            : timeBudgetSeconds(timeBudget)
+            , maxRegions(regions) {}
+        
+        // With a budget the tree is built best-first, on one thread
+        bool hasBudget() const { return timeBudgetSeconds > 0.0 || maxRegions > 0; }
+    };
+
+    // What the rendered output is made of - enough to guess how well it will encode
+    struct RegionSummary {
+        size_t regions = 0;     // Distinct color regions (countRegions)
+        size_t colors = 0;      // Distinct RGBA values across all leaves
+        size_t edgeLength = 0;  // Sum of width + height over all leaves - roughly the color changes along rows and columns
     };
 
     // The heart of the compression algorithm - a tree that splits the image into regions
@@ -27,17 +57,35 @@ namespace ImageCompression {
         // Each node represents a rectangular chunk of the image
         struct TreeNode {
             Rectangle region;                       // What part of the image this covers
-            Utils::HSLAPixel averageColor;         // The average color for this region
+            ColorSums colorSums;                    // Color totals - the average is worked out on demand
             std::unique_ptr<TreeNode> leftChild;   // Left or top half when we split
             std::unique_ptr<TreeNode> rightChild;  // Right or bottom half when we split
             
-            TreeNode(const Rectangle& rect, const Utils::HSLAPixel& avgColor)
-                : region(rect), averageColor(avgColor), leftChild(nullptr), rightChild(nullptr) {}
+            explicit TreeNode(const Rectangle& rect)
+                : region(rect), leftChild(nullptr), rightChild(nullptr) {}
+            
+            TreeNode(const Rectangle& rect, const ColorSums& sums)
+                : region(rect), colorSums(sums), leftChild(nullptr), rightChild(nullptr) {}
+            
+            // Nodes come from a per-thread recycling pool instead of one heap allocation each
+            static void* operator new(size_t size);
+            static void operator delete(void* node) noexcept;
+        };
+        
+        // A leaf's resolved color and size, lined up in tree order while pruning
+        struct LeafSample {
+            Utils::HSLAPixel color;
+            long area;
         };
         
     public:
         // Build the tree from an image - this analyzes the whole thing and creates the structure
-        explicit AdaptiveImageTree(const Utils::PNG& inputImage);
+        explicit AdaptiveImageTree(const Utils::PNG& inputImage,
+                                   const BuildConfig& buildConfig = BuildConfig());
+        
+        // Build the tree from statistics you already have (handy when they get reused between frames)
+        explicit AdaptiveImageTree(const ImageStatistics& statistics,
+                                   const BuildConfig& buildConfig = BuildConfig());
         
         // Copy constructor - make a duplicate tree
         AdaptiveImageTree(const AdaptiveImageTree& other);
@@ -51,54 +99,130 @@ namespace ImageCompression {
         // Turn the tree back into a PNG image - this is where you see the compression results
         Utils::PNG renderToImage() const;
         
+        // Same thing, but straight into pixels you own (must be the same size as the image)
+        // Each region's color is converted to bytes once and then just copied across its rows
+        void renderToBuffer(const Utils::MutableImageView& output) const;
+        
         // Remove unnecessary detail from the tree based on how similar colors are
         void pruneTree(const PruningConfig& config);
         
+        // Merge neighbouring leaves with nearly the same color, even when they aren't siblings
+        // The tree can only collapse siblings, so this catches matching regions split by an early cut
+        // Merged leaves only share a color - each keeps its own rectangle and the leaf count stays put
+        void mergeAdjacentRegions(const PruningConfig& config);
+        
+        // Rebuild only the branches that overlap changed areas - everything else is kept as-is
+        // The statistics must already describe the new image; splits come out the same as a
+        // full rebuild (kept branches can differ from fresh colors in the last few bits)
+        void rebuildRegions(const ImageStatistics& statistics,
+                            const std::vector<Rectangle>& changedRegions);
+        
         // Get the original image size
         std::pair<int, int> getImageDimensions() const;
         
         // Count how many regions we ended up with (fewer = more compression)
         size_t countLeafNodes() const;
         
+        // Count distinct color regions - same as the leaf count unless neighbours have been merged
+        size_t countRegions() const;
+        
         // Figure out how much we compressed it (smaller number = more compression)
         double getCompressionRatio() const;
         
+        // True if the build ran out of time or regions before it was done refining
+        // The tree is still complete - some regions are just bigger than they'd otherwise be
+        bool budgetExhausted() const;
+        
+        // Squared RGB error of rendering the tree as it stands against the original image
+        // One table lookup per leaf, so it's cheap enough to call after every trial prune
+        double squaredError(const SquaredErrorTable& errors) const;
+        
+        // Regions, distinct colors and edge length of the tree as it would be rendered
+        // One pass over the leaves - no pixels are touched
+        RegionSummary summarizeRegions() const;
+        
     private:
+        // Most split positions findOptimalSplit tries in each direction
+        static constexpr int MAX_SPLIT_CANDIDATES = 8;
+        
+        // Regions at least this big build and render their two halves on separate threads
+        // (when the thread limit allows) - below it the hand-off costs more than it saves
+        static constexpr long PARALLEL_MIN_PIXELS = 65536;
+        
+        // Best-first builds only look at the clock every this many splits
+        static constexpr size_t BUDGET_CHECK_INTERVAL = 64;
+        
         std::unique_ptr<TreeNode> rootNode_;
         int imageWidth_;
         int imageHeight_;
+        size_t mergedRegionCount_;  // Regions left after mergeAdjacentRegions (0 = not merged)
+        bool budgetExhausted_;      // The build stopped early (see BuildConfig)
         
         // Build the tree by recursively splitting regions where it makes sense
         std::unique_ptr<TreeNode> buildTreeRecursive(const ImageStatistics& statistics,
                                                     const Rectangle& region);
         
+        // Build the whole tree - best-first when there's a budget, otherwise recursively
+        void buildTree(const ImageStatistics& statistics, const BuildConfig& buildConfig);
+        
+        // Build within a budget: always split the leaf with the most detail (entropy x area) next,
+        // so wherever we stop, the effort went where it shows most. Every node starts out as a
+        // leaf with its own color, and with enough budget the result is the same as buildTreeRecursive.
+        std::unique_ptr<TreeNode> buildTreeBestFirst(const ImageStatistics& statistics,
+                                                    const Rectangle& region,
+                                                    const BuildConfig& buildConfig);
+        
+        // Work out split nodes' color totals from their children, the way buildTreeRecursive does
+        static void sumChildColors(TreeNode* node);
+        
+        // Bring a branch up to date with new statistics, reusing children that didn't change
+        void rebuildNodeRecursive(const ImageStatistics& statistics,
+                                  std::unique_ptr<TreeNode>& node,
+                                  const std::vector<Rectangle>& changedRegions);
+        
         // Find the best place to split a region (tries horizontal and vertical splits)
         std::pair<Rectangle, Rectangle> findOptimalSplit(const ImageStatistics& statistics,
                                                         const Rectangle& region);
         
-        // Walk through the tree and fill in pixels in the output image
-        void renderNodeRecursive(Utils::PNG& outputImage, 
+        // Walk through the tree and fill in pixels in the output image (imageWidth_ pixels per row)
+        void renderNodeRecursive(Utils::HSLAPixel* pixels, 
+                                const TreeNode* node) const;
+        
+        // Same walk, filling a caller-owned buffer instead
+        void renderNodeToBuffer(const Utils::MutableImageView& output,
                                 const TreeNode* node) const;
         
+        // Add up squaredError for every leaf under node
+        double squaredErrorRecursive(const TreeNode* node, const SquaredErrorTable& errors) const;
+        
         // Make a deep copy of a tree branch
         std::unique_ptr<TreeNode> copyTreeRecursive(const TreeNode* sourceNode);
         
         // Walk through the tree and remove branches that don't add much detail
+        // Each surviving leaf's color gets resolved once and appended to leafSamples,
+        // so a branch's leaves are always the samples from where it started to the end
         void pruneNodeRecursive(std::unique_ptr<TreeNode>& node, 
-                               const PruningConfig& config);
+                               const PruningConfig& config,
+                               std::vector<LeafSample>& leafSamples);
         
         // Check if a tree branch is simple enough that we can just use one color for the whole thing
-        bool shouldPruneSubtree(const TreeNode* node, const PruningConfig& config) const;
+        bool shouldPruneSubtree(const Utils::HSLAPixel& branchColor,
+                                const LeafSample* firstLeaf,
+                                const LeafSample* lastLeaf,
+                                const PruningConfig& config) const;
+        
+        // The average color of a node, worked out from its color totals
+        Utils::HSLAPixel getNodeColor(const TreeNode* node) const;
         
-        // Count how many pixels in a tree branch are similar to a reference color
-        int countSimilarPixels(const TreeNode* node, 
-                             const Utils::HSLAPixel& referenceColor,
-                             double tolerance, 
-                             int& totalPixels) const;
+        // Number of pixels a rectangle covers
+        static long getRegionArea(const Rectangle& region);
         
         // Count leaf nodes in a tree branch
         size_t countLeafNodesRecursive(const TreeNode* node) const;
         
+        // Gather every leaf in a tree branch (used by region merging and summarizeRegions)
+        static void collectLeafNodes(TreeNode* node, std::vector<TreeNode*>& leaves);
+        
         // Figure out how different two colors are (in a way that matches human vision)
         double calculateColorDistance(const Utils::HSLAPixel& color1,
                                     const Utils::HSLAPixel& color2) const;
@@ -3,6 +3,10 @@
 
 #include "../utils/image/PNG.h"
 #include "AdaptiveImageTree.h"
+#include "StageMetrics.h"
+#include "../utils/memory/MemoryAccounting.h"
+#include <chrono>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -24,6 +28,13 @@ namespace ImageCompression {
         size_t originalPixels;
         size_t compressedRegions;
         double processingTimeSeconds;
+        bool servedFromCache = false;   // Came from a ResultCache - compressedImage is left empty then
+        Utils::MemoryUsage memoryUsage; // Peak tracked memory from decoding through encoding, split by owner
+        StageMetrics stageMetrics;      // Time (and hardware counters, if enabled) for each stage
+        bool budgetExhausted = false;   // The tree build hit its BuildConfig time or region budget and stopped early
+        double qualityScore = -1.0;     // Quality compressToQuality settled on (-1 = not searched)
+        double psnr = 0.0;              // RGB PSNR against the original in dB, if it was measured
+        size_t encodedBytes = 0;        // Size of the PNG, when the call encoded it into memory
         
         CompressionResult(const Utils::PNG& image, double ratio, 
                          size_t origPixels, size_t regions, double time)
@@ -32,10 +43,28 @@ namespace ImageCompression {
               processingTimeSeconds(time) {}
     };
 
+    class ResultCache;
+    class SquaredErrorTable;
+
     // Main class for compressing images - this is what you'll use most of the time
     // It uses a smart tree algorithm that preserves important details while throwing away redundant stuff
+    //
+    // Thread safety: every function here can be called from any number of threads at once.
+    // The library keeps no mutable global state besides things that are safe to share -
+    // lookup tables built once on first use, the thread limit and allocation policy (atomic
+    // or locked), the task scheduler and per-thread node pools and counters. What you pass
+    // in is only read, so several threads may compress the same PNG at the same time; the
+    // one rule is the usual one - don't modify an object (a PNG, a tree, a SequenceCompressor)
+    // while another thread is using it. A PNG copy shares its pixels until written, and
+    // that sharing is safe across threads too. A ResultCache can be shared by all threads.
+    // Each call may also fan out onto the shared worker threads, up to Utils::getThreadLimit()
+    // in total across everything running in the process.
     class ImageCompressor {
     public:
+        // Bump whenever the output for the same input and settings changes,
+        // so cached results from older builds stop matching
+        static constexpr int ALGORITHM_VERSION = 2;
+        
         // Compress an image with a quality from 0.0 to 1.0
         // 0.0 = tiny file, might look pixelated
         // 1.0 = huge file, looks perfect
@@ -51,6 +80,11 @@ namespace ImageCompression {
         static CompressionResult compressImage(const Utils::PNG& inputImage,
                                              const PruningConfig& config);
         
+        // Same, plus control over how the tree gets built
+        static CompressionResult compressImage(const Utils::PNG& inputImage,
+                                             const PruningConfig& config,
+                                             const BuildConfig& buildConfig);
+        
         // Load a PNG file, compress it, and save it - the easy way to compress files
         static CompressionResult compressImageFile(const std::string& inputFilePath,
                                                   const std::string& outputFilePath,
@@ -61,6 +95,94 @@ namespace ImageCompression {
                                                   const std::string& outputFilePath,
                                                   CompressionQuality quality);
         
+        // Same thing with your own settings, including how the tree gets built
+        // A time budget in buildConfig counts from when the statistics start, so it covers
+        // everything that depends on the image content - decoding and encoding aren't included
+        static CompressionResult compressImageFile(const std::string& inputFilePath,
+                                                  const std::string& outputFilePath,
+                                                  const PruningConfig& config,
+                                                  const BuildConfig& buildConfig);
+        
+        // Compress a PNG that's already in memory and encode the result into out - no files involved
+        // out is overwritten, and keeps its capacity, so reusing one vector across calls avoids reallocating
+        static CompressionResult compressBuffer(const uint8_t* data, size_t size,
+                                              std::vector<uint8_t>& out,
+                                              double qualityScore = 0.5);
+        
+        // Same thing with your own settings
+        static CompressionResult compressBuffer(const uint8_t* data, size_t size,
+                                              std::vector<uint8_t>& out,
+                                              const PruningConfig& config);
+        
+        // Same, plus control over how the tree gets built (e.g. a time budget)
+        static CompressionResult compressBuffer(const uint8_t* data, size_t size,
+                                              std::vector<uint8_t>& out,
+                                              const PruningConfig& config,
+                                              const BuildConfig& buildConfig);
+        
+        // Same, going through a result cache first - a hit copies the cached PNG into out
+        // without decoding anything (compressedImage stays empty)
+        static CompressionResult compressBuffer(const uint8_t* data, size_t size,
+                                              std::vector<uint8_t>& out,
+                                              const PruningConfig& config,
+                                              ResultCache& cache);
+        
+        // Compress pixels you already have in memory and write the result into your own buffer
+        // Nothing is copied into a PNG on the way in or out, so compressedImage in the result is empty
+        // input and output may be the same buffer
+        static CompressionResult compressPixels(const Utils::ImageView& input,
+                                              const Utils::MutableImageView& output,
+                                              double qualityScore = 0.5);
+        
+        // Same thing with your own settings
+        static CompressionResult compressPixels(const Utils::ImageView& input,
+                                              const Utils::MutableImageView& output,
+                                              const PruningConfig& config);
+        
+        // Load, compress and save, going through a result cache first
+        // A hit copies the cached output without decoding anything (compressedImage stays empty)
+        static CompressionResult compressImageFile(const std::string& inputFilePath,
+                                                  const std::string& outputFilePath,
+                                                  const PruningConfig& config,
+                                                  ResultCache& cache);
+        
+        // Prune and render a tree you already built - the tree itself is left untouched,
+        // so one build can be reused for several configs or frames
+        static CompressionResult compressTree(const AdaptiveImageTree& tree,
+                                            const PruningConfig& config);
+        
+        // Build, prune and render from statistics you already computed (and maybe want to reuse
+        // for the next image with ImageStatistics::rebuild)
+        static CompressionResult compressStatistics(const ImageStatistics& statistics,
+                                                  const PruningConfig& config);
+        
+        // Same, rendering into your own buffer (compressedImage in the result stays empty)
+        static CompressionResult compressStatistics(const ImageStatistics& statistics,
+                                                  const PruningConfig& config,
+                                                  const Utils::MutableImageView& output);
+        
+        // Same, with control over how the tree gets built (e.g. a time budget, which here
+        // covers only the tree build - the statistics are already done)
+        static CompressionResult compressStatistics(const ImageStatistics& statistics,
+                                                  const PruningConfig& config,
+                                                  const BuildConfig& buildConfig);
+        
+        // Smallest output whose RGB PSNR against the original is at least targetPsnr dB
+        // The tree is built once, then the quality score is binary-searched with trial prunes
+        // whose error comes from summed-area tables of the original - nothing is rendered or
+        // encoded until the answer is known. If even quality 1.0 falls short, that's what
+        // you get (check psnr in the result)
+        static CompressionResult compressToQuality(const Utils::PNG& inputImage, double targetPsnr);
+        
+        // Highest quality whose encoded PNG fits in maxBytes, encoded into out
+        // Like compressToQuality the tree is built once; each trial prune is sized from its
+        // regions, colors and edge length instead of running the encoder, and only the pick gets
+        // encoded. If that still comes out too big, the estimate is recalibrated against the real
+        // size and the search runs once more. If even quality 0.0 doesn't fit, you get that -
+        // check out.size()
+        static CompressionResult compressToSize(const Utils::PNG& inputImage, size_t maxBytes,
+                                              std::vector<uint8_t>& out);
+        
         // Compress the same image at multiple quality levels for comparison
         static std::vector<CompressionResult> generateCompressionSeries(const Utils::PNG& inputImage,
                                                                        const std::string& outputPrefix);
@@ -78,9 +200,40 @@ namespace ImageCompression {
         static std::string getQualityName(CompressionQuality quality);
         
     private:
+        // Halvings of the quality range compressToQuality tries - 8 gets within 1/256
+        static constexpr int QUALITY_SEARCH_STEPS = 8;
+        
+        // Rough encoded PNG cost of the pieces in a RegionSummary, fitted on photos, gradients,
+        // noise, pixel art and screenshots. Good to within about 2x for any one image, and the
+        // error barely moves with quality, which is what makes one recalibration enough
+        static constexpr double BYTES_PER_REGION = 1.85;
+        static constexpr double BYTES_PER_COLOR = 1.65;
+        static constexpr double BYTES_PER_EDGE_PIXEL = 0.125;
+        
+        // A recalibrated search aims this far under the limit - there's no second retry
+        static constexpr double RETRY_HEADROOM = 0.9;
+        
+        // Prune and merge the tree the way every compression does before it renders
+        static void pruneForRender(AdaptiveImageTree& tree, const PruningConfig& config);
+        
+        // Prune a copy of the tree and measure its PSNR
+        static double measurePsnr(const AdaptiveImageTree& tree, const PruningConfig& config,
+                                  const SquaredErrorTable& errors);
+        
+        // Prune a copy of the tree and guess how many bytes it encodes to (before calibration)
+        static double estimateEncodedBytes(const AdaptiveImageTree& tree, const PruningConfig& config);
+        
         // The actual compression work happens here - builds tree, prunes it, renders result
         static CompressionResult performCompression(const Utils::PNG& inputImage,
-                                                  const PruningConfig& config);
+                                                  const PruningConfig& config,
+                                                  const BuildConfig& buildConfig = BuildConfig());
+        
+        // Everything after the tree is built - prune, merge, render and collect the numbers
+        // With an output buffer the result is rendered there and compressedImage stays empty
+        static CompressionResult finishCompression(AdaptiveImageTree& tree,
+                                                 const PruningConfig& config,
+                                                 std::chrono::high_resolution_clock::time_point startTime,
+                                                 const Utils::MutableImageView* output = nullptr);
     };
 
 } // namespace ImageCompression
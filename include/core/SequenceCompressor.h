@@ -0,0 +1,52 @@
+#ifndef IMAGE_COMPRESSION_SEQUENCE_COMPRESSOR_H
+#define IMAGE_COMPRESSION_SEQUENCE_COMPRESSOR_H
+
+#include "ImageCompressor.h"
+#include <memory>
+#include <vector>
+
+namespace ImageCompression {
+
+    // Compresses a run of frames (screen captures, timelapses) where most of each frame
+    // matches the one before it. Only the parts that changed get re-analyzed:
+    // an identical frame costs one comparison pass, a small edit refreshes only the
+    // statistics below and right of it and rebuilds only the tree branches that overlap it.
+    class SequenceCompressor {
+    public:
+        // Same quality scale as ImageCompressor (0.0 = tiny file, 1.0 = looks perfect)
+        explicit SequenceCompressor(double qualityScore = 0.5);
+        
+        // If you want to mess with the internal settings
+        explicit SequenceCompressor(const PruningConfig& config);
+        
+        // Compress the next frame, reusing whatever the previous frame already worked out
+        CompressionResult compressFrame(const Utils::PNG& frame);
+        
+        // Forget the previous frame - the next one gets a full compress
+        void reset();
+        
+        // How many frames we've seen since the last reset
+        size_t getFramesProcessed() const { return framesProcessed_; }
+        
+        // Find which parts of the image differ between two frames of the same size
+        // Changes are reported as tile-aligned rectangles, merged where they line up
+        static std::vector<Rectangle> findChangedRegions(const Utils::PNG& previous,
+                                                         const Utils::PNG& current);
+        
+    private:
+        // Side length of the squares frames get compared in
+        static constexpr int DIFF_TILE_SIZE = 32;
+        
+        PruningConfig config_;
+        size_t framesProcessed_;
+        
+        // What we remember from the previous frame
+        Utils::PNG previousFrame_;
+        std::unique_ptr<ImageStatistics> statistics_;
+        std::unique_ptr<AdaptiveImageTree> fullTree_;      // Kept unpruned so it can be patched
+        std::unique_ptr<CompressionResult> previousResult_;
+    };
+
+} // namespace ImageCompression
+
+#endif // IMAGE_COMPRESSION_SEQUENCE_COMPRESSOR_H 
\ No newline at end of file
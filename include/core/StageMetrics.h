@@ -0,0 +1,79 @@
+#ifndef IMAGE_COMPRESSION_STAGE_METRICS_H
+#define IMAGE_COMPRESSION_STAGE_METRICS_H
+
+#include "../utils/perf/PerfCounters.h"
+#include <chrono>
+#include <cstddef>
+
+namespace ImageCompression {
+
+    // The steps one compression goes through, in order
+    enum class PipelineStage {
+        Decode,       // PNG bytes to pixels
+        Statistics,   // Summed-area tables
+        TreeBuild,    // Splitting the image into regions
+        Prune,        // Collapsing similar branches and merging neighbours
+        Render,       // Filling each region with its color
+        Encode        // Pixels back to PNG bytes
+    };
+
+    constexpr size_t PIPELINE_STAGE_COUNT = 6;
+
+    // Short name for reports ("decode", "tree-build", ...)
+    const char* pipelineStageName(PipelineStage stage);
+
+    // Time and hardware counters for one stage
+    // counters stays empty unless Utils::enablePerfCounters() was called and the CPU allows it
+    struct StageMeasurement {
+        double wallSeconds = 0.0;
+        Utils::PerfCounterValues counters;
+        bool measured = false;   // False for stages this compression didn't go through
+        
+        StageMeasurement& operator+=(const StageMeasurement& other) {
+            wallSeconds += other.wallSeconds;
+            counters += other.counters;
+            measured = measured || other.measured;
+            return *this;
+        }
+    };
+
+    // One measurement per pipeline stage
+    struct StageMetrics {
+        StageMeasurement stages[PIPELINE_STAGE_COUNT];
+        
+        StageMeasurement& operator[](PipelineStage stage) { return stages[static_cast<size_t>(stage)]; }
+        const StageMeasurement& operator[](PipelineStage stage) const { return stages[static_cast<size_t>(stage)]; }
+        
+        StageMetrics& operator+=(const StageMetrics& other) {
+            for (size_t i = 0; i < PIPELINE_STAGE_COUNT; ++i) {
+                stages[i] += other.stages[i];
+            }
+            return *this;
+        }
+    };
+
+    // Starts the clock (and the counters) when created - finish() says what happened since
+    // Counters are per thread, so create and finish it on the thread doing the work
+    class StageProbe {
+    public:
+        StageProbe()
+            : startCounters_(Utils::readPerfCounters()),
+              startTime_(std::chrono::steady_clock::now()) {}
+        
+        StageMeasurement finish() const {
+            StageMeasurement measurement;
+            measurement.wallSeconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - startTime_).count();
+            measurement.counters = startCounters_.until(Utils::readPerfCounters());
+            measurement.measured = true;
+            return measurement;
+        }
+
+    private:
+        Utils::PerfCounterValues startCounters_;
+        std::chrono::steady_clock::time_point startTime_;
+    };
+
+} // namespace ImageCompression
+
+#endif // IMAGE_COMPRESSION_STAGE_METRICS_H 
\ No newline at end of file
@@ -0,0 +1,151 @@
+#ifndef IMAGE_COMPRESSION_COMPRESSION_DAEMON_H
+#define IMAGE_COMPRESSION_COMPRESSION_DAEMON_H
+
+#include "../core/ImageCompressor.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ImageCompression {
+
+    // How the daemon should run
+    struct DaemonConfig {
+        std::string socketPath;     // Where the Unix socket lives
+        size_t workerCount;         // Threads doing the actual compression (at most getThreadLimit())
+        size_t queueCapacity;       // Jobs allowed to wait - past this, clients wait for room
+        double timeBudgetSeconds;   // Per job, from when a worker picks it up (0 = no budget)
+        size_t maxConnections;      // Clients served at once - each one costs two threads
+        
+        DaemonConfig(const std::string& path, size_t workers = 2, size_t capacity = 64, double timeBudget = 0.0,
+                     size_t connections = 32)
+            : socketPath(path), workerCount(workers), queueCapacity(capacity), timeBudgetSeconds(timeBudget),
+              maxConnections(connections) {}
+    };
+
+    // Keeps the compressor running in the background so callers don't pay for process start,
+    // fresh allocations and cold caches on every image. Each worker thread holds on to its
+    // ImageStatistics and rebuilds it in place, so the big tables stay allocated and faulted in.
+    // Workers and the parallel stages inside each job share getThreadLimit() threads between
+    // them: while the daemon runs, each job's stages get what the workers leave over.
+    //
+    // Protocol (one line per request, fields separated by tabs):
+    //   <input path> TAB <output path> [TAB <quality 0.0-1.0>]
+    //   PING                          -> PONG
+    //   STATS                         -> STATS <completed> <failed> <queued>
+    //   QUIT                          -> closes the connection
+    // Every job gets exactly one reply line, in the order the jobs were sent:
+    //   OK <ratio> <regions> <pixels> <queue seconds> <processing seconds> <budget reached 0/1>
+    //   ERR <message>
+    // Requests can be pipelined - a client may send more jobs before earlier ones are answered,
+    // and they're queued as soon as they arrive. QUIT waits for the replies still owed.
+    // Past maxConnections a new client gets "ERR too many connections" and is closed; a line
+    // longer than MAX_LINE_BYTES gets "ERR request line too long" and closes its connection.
+    class CompressionDaemon {
+    public:
+        explicit CompressionDaemon(const DaemonConfig& config);
+        ~CompressionDaemon();
+        
+        CompressionDaemon(const CompressionDaemon&) = delete;
+        CompressionDaemon& operator=(const CompressionDaemon&) = delete;
+        
+        // Bind the socket and serve clients until stop() is called
+        void run();
+        
+        // Ask run() to finish - queued jobs still complete. Only touches an atomic flag,
+        // so it's fine to call from a signal handler
+        void stop();
+        
+        // Workers actually started - the configured count, capped at the thread limit
+        size_t getWorkerCount() const { return config_.workerCount; }
+
+    private:
+        // What a client gets back for one job
+        struct JobResult {
+            bool success = false;
+            std::string error;
+            double compressionRatio = 0.0;
+            size_t compressedRegions = 0;
+            size_t originalPixels = 0;
+            double queueSeconds = 0.0;
+            double processingSeconds = 0.0;
+            bool budgetExhausted = false;
+        };
+        
+        struct Job {
+            std::string inputPath;
+            std::string outputPath;
+            double qualityScore;
+            std::chrono::steady_clock::time_point queuedAt;
+            std::promise<JobResult> result;
+        };
+        
+        // A reply a connection still owes - either ready text or a job to wait for
+        struct PendingReply {
+            std::string text;
+            std::future<JobResult> result;
+        };
+        
+        // One connected client: its thread reads requests and queues the replies,
+        // and a second one sends them back in order as they become ready
+        struct Connection {
+            int socket;
+            std::thread thread;
+            std::atomic<bool> finished{false};
+            
+            std::mutex replyMutex;
+            std::condition_variable replyQueued;
+            std::deque<PendingReply> replies;
+            bool doneReading = false;
+        };
+        
+        // How long accept waits before checking whether we've been told to stop
+        static constexpr int ACCEPT_POLL_MILLISECONDS = 200;
+        
+        // Longest request line - two paths of PATH_MAX plus a quality fit comfortably
+        static constexpr size_t MAX_LINE_BYTES = 16384;
+        
+        DaemonConfig config_;
+        int listenSocket_;
+        std::atomic<bool> stopRequested_;
+        
+        // Bounded job queue shared by every connection and worker
+        std::mutex queueMutex_;
+        std::condition_variable jobAvailable_;
+        std::condition_variable spaceAvailable_;
+        std::deque<std::unique_ptr<Job>> queue_;
+        bool acceptingJobs_;
+        
+        std::atomic<size_t> jobsCompleted_;
+        std::atomic<size_t> jobsFailed_;
+        
+        std::vector<std::thread> workers_;
+        std::list<std::unique_ptr<Connection>> connections_;
+        
+        void openSocket();
+        void closeSocket();
+        
+        void workerLoop();
+        JobResult processJob(const Job& job, std::unique_ptr<ImageStatistics>& statistics);
+        
+        // Waits while the queue is full; returns an invalid future if the daemon is shutting down
+        std::future<JobResult> submitJob(std::unique_ptr<Job> job);
+        
+        void serveConnection(Connection& connection);
+        void sendReplies(Connection& connection);
+        PendingReply handleRequest(const std::string& line);
+        static std::string formatResult(const JobResult& result);
+        void reapFinishedConnections();
+        
+        static bool sendAll(int socket, const std::string& data);
+    };
+
+} // namespace ImageCompression
+
+#endif // IMAGE_COMPRESSION_COMPRESSION_DAEMON_H 
\ No newline at end of file
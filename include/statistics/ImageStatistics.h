@@ -3,6 +3,8 @@
 
 #include "../utils/image/PNG.h"
 #include "../utils/image/HSLAPixel.h"
+#include "../utils/image/ImageView.h"
+#include "../utils/memory/AlignedAllocator.h"
 #include <utility>
 #include <vector>
 #include <cmath>
@@ -19,6 +21,52 @@ namespace ImageCompression {
             
         Rectangle(int ulX, int ulY, int lrX, int lrY) 
             : upperLeft(std::make_pair(ulX, ulY)), lowerRight(std::make_pair(lrX, lrY)) {}
+        
+        bool operator==(const Rectangle& other) const {
+            return upperLeft == other.upperLeft && lowerRight == other.lowerRight;
+        }
+        
+        // True if the two rectangles share at least one pixel
+        bool intersects(const Rectangle& other) const {
+            return upperLeft.first <= other.lowerRight.first && other.upperLeft.first <= lowerRight.first &&
+                   upperLeft.second <= other.lowerRight.second && other.upperLeft.second <= lowerRight.second;
+        }
+    };
+
+    // Raw color totals for a region - what the cumulative tables actually store
+    // Cheap to add together; turning them into a color (with an atan2) can wait until it's needed
+    // Colors are weighted by alpha, so see-through pixels count less and invisible ones not at all
+    struct ColorSums {
+        double hueX = 0.0;        // Sum of alpha * saturation * cos(hue)
+        double hueY = 0.0;        // Sum of alpha * saturation * sin(hue)
+        double saturation = 0.0;  // Sum of alpha * saturation
+        double luminance = 0.0;   // Sum of alpha * luminance
+        double alpha = 0.0;       // Sum of alpha
+        
+        ColorSums& operator+=(const ColorSums& other) {
+            hueX += other.hueX;
+            hueY += other.hueY;
+            saturation += other.saturation;
+            luminance += other.luminance;
+            alpha += other.alpha;
+            return *this;
+        }
+        
+        ColorSums operator*(double factor) const {
+            ColorSums scaled = *this;
+            scaled.hueX *= factor;
+            scaled.hueY *= factor;
+            scaled.saturation *= factor;
+            scaled.luminance *= factor;
+            scaled.alpha *= factor;
+            return scaled;
+        }
+        
+        // True if nothing in the region is visible at all
+        // (alpha comes in 1/255 steps, so anything under half a step is rounding noise)
+        bool isFullyTransparent() const {
+            return alpha < 0.5 / 255.0;
+        }
     };
 
     // Pre-calculates statistics for the image so we can quickly analyze any rectangular region
@@ -27,6 +75,8 @@ namespace ImageCompression {
     public:
         static constexpr double PI = 3.14159265358979323846;
         static constexpr int HUE_BINS = 36;  // 360 degrees / 10 degrees per bin
+        static constexpr int TRANSPARENT_BIN = HUE_BINS;       // Fully transparent pixels go here, whatever their hue
+        static constexpr int HISTOGRAM_BINS = HUE_BINS + 1;
         
         /**
          * @brief Constructs statistics for the given image
@@ -34,6 +84,67 @@ namespace ImageCompression {
          */
         explicit ImageStatistics(const Utils::PNG& image);
         
+        /**
+         * @brief Constructs statistics straight from caller-owned pixels
+         * 
+         * Pixels are converted to HSLA one at a time as the tables are filled,
+         * so no intermediate PNG copy of the image is made.
+         * 
+         * @param view The pixels to analyze (RGBA8, RGB8 or BGRA8, any row stride)
+         */
+        explicit ImageStatistics(const Utils::ImageView& view);
+        
+        /**
+         * @brief Recomputes the statistics for a different image, reusing the table memory
+         * 
+         * Long-running callers (like the daemon workers) keep one of these around
+         * and rebuild it per image instead of paying for fresh multi-gigabyte
+         * allocations and page faults every time.
+         * 
+         * @param image The new image to analyze (any size)
+         */
+        void rebuild(const Utils::PNG& image);
+        
+        /**
+         * @brief Recomputes the statistics for caller-owned pixels, reusing the table memory
+         * @param view The new pixels to analyze (any size)
+         */
+        void rebuild(const Utils::ImageView& view);
+        
+        /**
+         * @brief Refreshes the statistics after part of the image changed
+         * 
+         * A pixel only feeds the cumulative sums below and to the right of it, so
+         * only that suffix of each table is recomputed. Cost is proportional to
+         * (width - left) * (height - top) of the changed area, not the whole image.
+         * 
+         * @param image The modified image (same size as the one analyzed before)
+         * @param changedRegion Rectangle containing every pixel that changed
+         * @throws std::invalid_argument if the image size doesn't match or the rectangle
+         *         isn't inside the image
+         */
+        void update(const Utils::PNG& image, const Rectangle& changedRegion);
+        
+        /**
+         * @brief Refreshes the statistics after several parts of the image changed
+         * @param image The modified image (same size as the one analyzed before)
+         * @param changedRegions Rectangles containing every pixel that changed
+         * @throws std::invalid_argument under the same conditions as the single-rectangle update
+         */
+        void update(const Utils::PNG& image, const std::vector<Rectangle>& changedRegions);
+        
+        /**
+         * @brief Gets the width of the analyzed image
+         * @return Width in pixels
+         */
+        int getWidth() const { return imageWidth_; }
+        
+        /**
+         * @brief Gets the height of the analyzed image
+         * @return Height in pixels
+         */
+        int getHeight() const { return imageHeight_; }
+        
         /**
          * @brief Gets the average color for a rectangular region
          * @param region The rectangular region to analyze
@@ -41,6 +152,28 @@ namespace ImageCompression {
          */
         Utils::HSLAPixel getAverageColor(const Rectangle& region) const;
         
+        /**
+         * @brief Gets the raw color totals for a rectangular region
+         * @param region The rectangular region to analyze
+         * @return Summed color components - see averageFromSums
+         */
+        ColorSums getColorSums(const Rectangle& region) const;
+        
+        /**
+         * @brief Checks if every pixel in a region is fully transparent (O(1) via the transparent histogram bin)
+         * @param region The rectangular region to analyze
+         * @return true if nothing in the region is visible
+         */
+        bool isFullyTransparent(const Rectangle& region) const;
+        
+        /**
+         * @brief Turns color totals into the average color they describe
+         * @param sums Summed color components
+         * @param pixelCount Number of pixels the sums cover
+         * @return Average HSLA pixel
+         */
+        static Utils::HSLAPixel averageFromSums(const ColorSums& sums, long pixelCount);
+        
         /**
          * @brief Calculates the area (number of pixels) in a rectangle
          * @param region The rectangular region
@@ -50,6 +183,8 @@ namespace ImageCompression {
         
         /**
          * @brief Computes entropy for a rectangular region based on hue distribution
+         * 
+         * Uses a histogram on the stack, so it never allocates.
          * @param region The rectangular region to analyze
          * @return Entropy value for the region
          */
@@ -79,18 +214,32 @@ namespace ImageCompression {
         
     private:
         // Flat arrays for efficient memory access (row-major order)
-        std::vector<double> cumulativeHueX_;     // size: width * height
-        std::vector<double> cumulativeHueY_;     // size: width * height
-        std::vector<double> cumulativeSaturation_; // size: width * height
-        std::vector<double> cumulativeLuminance_;  // size: width * height
+        // Cache-line aligned, and huge-page backed once they're big, since region
+        // queries hit them all over the place
+        using TablePlane = Utils::AlignedVector<double, Utils::MemoryOwner::StatisticsTables>;
+        TablePlane cumulativeHueX_;     // size: width * height
+        TablePlane cumulativeHueY_;     // size: width * height
+        TablePlane cumulativeSaturation_; // size: width * height
+        TablePlane cumulativeLuminance_;  // size: width * height
+        TablePlane cumulativeAlpha_;      // size: width * height
         
-        // Flat 3D array: [width * height * HUE_BINS] for hue histograms
-        std::vector<int> cumulativeHueHistogram_;  // size: width * height * HUE_BINS
+        // Flat 3D array: [width * height * HISTOGRAM_BINS] for hue histograms (plus the transparent bin)
+        Utils::AlignedVector<int, Utils::MemoryOwner::StatisticsTables> cumulativeHueHistogram_;  // size: width * height * HISTOGRAM_BINS
         
-        // Pre-computed trigonometry lookup tables for performance
-        static std::vector<double> cosLookup_;
-        static std::vector<double> sinLookup_;
-        static bool lookupTablesInitialized_;
+        // Cosine and sine of every whole degree, for converting hues to x/y
+        struct TrigTables {
+            double cosine[360];
+            double sine[360];
+            
+            TrigTables();
+        };
+        
+        // Built on first use by whichever thread gets there first - a function-local
+        // static, so that's race-free - and only ever read after that
+        static const TrigTables& trigTables() {
+            static const TrigTables tables;
+            return tables;
+        }
         
         // Helper functions for flat array indexing
         inline size_t getIndex(int x, int y) const {
@@ -98,23 +247,55 @@ namespace ImageCompression {
         }
         
         inline size_t getHistogramIndex(int x, int y, int bin) const {
-            return (static_cast<size_t>(y) * imageWidth_ + x) * HUE_BINS + bin;
+            return (static_cast<size_t>(y) * imageWidth_ + x) * HISTOGRAM_BINS + bin;
         }
         
-        // Initialize trigonometry lookup tables (called once)
-        static void initializeLookupTables();
+        /**
+         * @brief Sets the dimensions and sizes the tables for a full-resolution image
+         * @param width Image width in pixels
+         * @param height Image height in pixels
+         */
+        void resizeTables(int width, int height);
+        
+        /**
+         * @brief Fills the cumulative tables from (startX, startY) to the bottom-right corner
+         * @param pixels Source of HSLA pixels - anything with an at(x, y) method
+         * @param startX First column to recompute
+         * @param startY First row to recompute
+         */
+        template <typename PixelSource>
+        void buildCumulativeTables(const PixelSource& pixels, int startX, int startY);
+        
+        /**
+         * @brief Fills the cumulative tables for one rectangle of pixels, row by row
+         *
+         * The entries above and to the left of the rectangle must already be done.
+         *
+         * @param pixels Source of HSLA pixels
+         * @param startX First column
+         * @param startY First row
+         * @param endX One past the last column
+         * @param endY One past the last row
+         */
+        template <typename PixelSource>
+        void buildCumulativeTile(const PixelSource& pixels, int startX, int startY, int endX, int endY);
+        
+        // Tile size for building the tables on several threads
+        static constexpr int TILE_WIDTH = 128;
+        static constexpr int TILE_HEIGHT = 32;
+
         
         // Fast trigonometry using lookup tables
-        inline double fastCos(double hue) const {
+        static inline double fastCos(const TrigTables& tables, double hue) {
             int index = static_cast<int>(hue) % 360;
             if (index < 0) index += 360;
-            return cosLookup_[index];
+            return tables.cosine[index];
         }
         
-        inline double fastSin(double hue) const {
+        static inline double fastSin(const TrigTables& tables, double hue) {
             int index = static_cast<int>(hue) % 360;
             if (index < 0) index += 360;
-            return sinLookup_[index];
+            return tables.sine[index];
         }
         
         /**
@@ -144,6 +325,22 @@ namespace ImageCompression {
         double calculateEntropyFromDistribution(const std::vector<int>& distribution, 
                                                int totalArea) const;
         
+        /**
+         * @brief Calculates entropy from bin counts in a plain array (no allocation)
+         * @param counts Count per bin
+         * @param binCount Number of bins
+         * @param totalArea Total number of elements
+         * @return Entropy value
+         */
+        static double calculateEntropyFromCounts(const int* counts, size_t binCount, long totalArea);
+        
+        /**
+         * @brief Fills a caller-provided array with a region's hue histogram
+         * @param region The rectangular region
+         * @param histogram Receives HISTOGRAM_BINS counts
+         */
+        void fillHueHistogram(const Rectangle& region, int* histogram) const;
+        
         /**
          * @brief Validates that a rectangle is within image bounds
          * @param region Rectangle to validate
@@ -151,6 +348,13 @@ namespace ImageCompression {
          */
         bool isValidRectangle(const Rectangle& region) const;
         
+        /**
+         * @brief Rejects a changed region that isn't entirely inside the image
+         * @param region Rectangle passed to update()
+         * @throws std::invalid_argument if it reaches outside or is empty
+         */
+        void checkChangedRegion(const Rectangle& region) const;
+        
         // Image dimensions
         int imageWidth_;
         int imageHeight_;
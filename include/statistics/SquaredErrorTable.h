@@ -0,0 +1,62 @@
+#ifndef IMAGE_COMPRESSION_SQUARED_ERROR_TABLE_H
+#define IMAGE_COMPRESSION_SQUARED_ERROR_TABLE_H
+
+#include "ImageStatistics.h"
+#include "../utils/image/ColorConversion.h"
+#include "../utils/memory/AlignedAllocator.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace ImageCompression {
+
+    // Summed-area tables of the original RGB values and their squares, so the squared error
+    // of painting any rectangle one flat color is a handful of lookups instead of a pass over
+    // its pixels. Only the quality-targeting path needs these, so they're kept apart from
+    // ImageStatistics and cost nothing for a normal compression.
+    class SquaredErrorTable {
+    public:
+        /**
+         * @brief Builds the tables from the RGB values the image would be saved with
+         * @param image The original image
+         */
+        explicit SquaredErrorTable(const Utils::PNG& image);
+        
+        /**
+         * @brief Squared error of painting a region one color, summed over red, green and blue
+         *
+         * Uses sum((p - c)^2) = sum(p^2) - 2c * sum(p) + n * c^2 per channel, all exact in integers.
+         * @param region The rectangular region
+         * @param color What the region gets painted with
+         * @return Total squared error in 8-bit units
+         */
+        double squaredError(const Rectangle& region, const Utils::RGBColor& color) const;
+        
+        /**
+         * @brief Turns the total squared error over the whole image into PSNR
+         * @param totalSquaredError Sum of squaredError over regions that tile the image
+         * @return PSNR in dB (infinity for a perfect match)
+         */
+        double psnr(double totalSquaredError) const;
+        
+        int getWidth() const { return imageWidth_; }
+        int getHeight() const { return imageHeight_; }
+
+    private:
+        // Everything one lookup needs sits together, so a corner is one or two cache lines
+        struct ChannelSums {
+            uint64_t sum[3];       // Red, green, blue
+            uint64_t squares[3];
+        };
+        
+        Utils::AlignedVector<ChannelSums, Utils::MemoryOwner::StatisticsTables> cumulative_;  // size: width * height
+        int imageWidth_;
+        int imageHeight_;
+        
+        inline size_t getIndex(int x, int y) const {
+            return static_cast<size_t>(y) * imageWidth_ + x;
+        }
+    };
+
+} // namespace ImageCompression
+
+#endif // IMAGE_COMPRESSION_SQUARED_ERROR_TABLE_H 
\ No newline at end of file
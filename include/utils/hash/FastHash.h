@@ -0,0 +1,66 @@
+/**
+ * @file FastHash.h
+ * @brief Fast, stable 64-bit non-cryptographic hashing
+ *
+ * Implements the XXH64 algorithm, so digests match any other XXH64
+ * implementation and stay the same across platforms, compilers and runs.
+ * Good for cache keys and duplicate detection - not for anything that
+ * needs to resist deliberate collisions.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ImageCompression {
+namespace Utils {
+
+/**
+ * @brief Incremental XXH64 hasher
+ *
+ * Feed data in any number of update() calls - the digest only depends on
+ * the concatenated bytes, not on how they were split up. Bulk input is
+ * consumed 32 bytes at a time in four independent lanes, which keeps the
+ * multipliers busy and runs at several GB/s.
+ */
+class FastHash {
+public:
+    /**
+     * @brief Start a new hash
+     * @param seed Different seeds give unrelated digests for the same data
+     */
+    explicit FastHash(uint64_t seed = 0);
+
+    /**
+     * @brief Add more bytes to the hash
+     * @param data Bytes to add
+     * @param size Number of bytes
+     */
+    void update(const void* data, size_t size);
+
+    /**
+     * @brief Get the hash of everything added so far (more can still be added afterwards)
+     * @return 64-bit digest
+     */
+    uint64_t digest() const;
+
+    /**
+     * @brief Hash a single buffer in one go
+     * @param data Bytes to hash
+     * @param size Number of bytes
+     * @param seed Hash seed
+     * @return 64-bit digest
+     */
+    static uint64_t hash(const void* data, size_t size, uint64_t seed = 0);
+
+private:
+    uint64_t seed_;                 ///< Seed the hash started from
+    uint64_t lanes_[4];             ///< Accumulators for 32-byte stripes
+    uint64_t totalLength_;          ///< Bytes added so far
+    unsigned char buffer_[32];      ///< Partial stripe waiting for more data
+    size_t bufferSize_;             ///< Bytes in buffer_
+};
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file
@@ -0,0 +1,126 @@
+/**
+ * @file ImageView.h
+ * @brief Non-owning views of pixel buffers that live in the caller's memory
+ *
+ * Lets embedders hand already-decoded frames straight to the compressor,
+ * and get results written back into their own buffers, without copying
+ * through a PNG object first.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "ColorConversion.h"
+
+namespace ImageCompression {
+namespace Utils {
+
+/**
+ * @brief Byte layout of one pixel in a caller-owned buffer (8 bits per channel)
+ */
+enum class PixelFormat {
+    RGBA8,  ///< Red, green, blue, alpha
+    RGB8,   ///< Red, green, blue - treated as fully opaque
+    BGRA8   ///< Blue, green, red, alpha (common for OS and GPU frame buffers)
+};
+
+/**
+ * @brief Get how many bytes one pixel takes in a format
+ * @param format Pixel layout
+ * @return Bytes per pixel
+ */
+inline size_t bytesPerPixel(PixelFormat format) {
+    return format == PixelFormat::RGB8 ? 3 : 4;
+}
+
+/**
+ * @brief Read-only view of caller-owned pixels
+ *
+ * Rows are stride bytes apart, so padded rows and sub-rectangles of larger
+ * buffers work as-is. The view never owns or copies the memory.
+ */
+struct ImageView {
+    const uint8_t* data;   ///< First byte of the top-left pixel
+    unsigned int width;    ///< Width in pixels
+    unsigned int height;   ///< Height in pixels
+    size_t stride;         ///< Bytes from the start of one row to the next
+    PixelFormat format;    ///< Byte layout of each pixel
+
+    /**
+     * @brief Construct a view over existing pixels
+     * @param pixels First byte of the top-left pixel
+     * @param w Width in pixels
+     * @param h Height in pixels
+     * @param rowStride Bytes between rows (0 = tightly packed)
+     * @param pixelFormat Byte layout of each pixel
+     */
+    ImageView(const uint8_t* pixels, unsigned int w, unsigned int h,
+              size_t rowStride = 0, PixelFormat pixelFormat = PixelFormat::RGBA8)
+        : data(pixels), width(w), height(h),
+          stride(rowStride ? rowStride : w * bytesPerPixel(pixelFormat)), format(pixelFormat) {}
+
+    /**
+     * @brief Read one pixel as RGBA
+     * @param x X coordinate (0 = leftmost)
+     * @param y Y coordinate (0 = topmost)
+     * @return Pixel color
+     */
+    RGBColor getPixel(unsigned int x, unsigned int y) const {
+        const uint8_t* pixel = data + y * stride + x * bytesPerPixel(format);
+        switch (format) {
+            case PixelFormat::RGB8:
+                return RGBColor(pixel[0], pixel[1], pixel[2], 255);
+            case PixelFormat::BGRA8:
+                return RGBColor(pixel[2], pixel[1], pixel[0], pixel[3]);
+            default:
+                return RGBColor(pixel[0], pixel[1], pixel[2], pixel[3]);
+        }
+    }
+};
+
+/**
+ * @brief Writable view of caller-owned pixels, used as an output target
+ */
+struct MutableImageView {
+    uint8_t* data;         ///< First byte of the top-left pixel
+    unsigned int width;    ///< Width in pixels
+    unsigned int height;   ///< Height in pixels
+    size_t stride;         ///< Bytes from the start of one row to the next
+    PixelFormat format;    ///< Byte layout of each pixel
+
+    /**
+     * @brief Construct a view over a caller-provided output buffer
+     * @param pixels First byte of the top-left pixel
+     * @param w Width in pixels
+     * @param h Height in pixels
+     * @param rowStride Bytes between rows (0 = tightly packed)
+     * @param pixelFormat Byte layout of each pixel
+     */
+    MutableImageView(uint8_t* pixels, unsigned int w, unsigned int h,
+                     size_t rowStride = 0, PixelFormat pixelFormat = PixelFormat::RGBA8)
+        : data(pixels), width(w), height(h),
+          stride(rowStride ? rowStride : w * bytesPerPixel(pixelFormat)), format(pixelFormat) {}
+
+    /**
+     * @brief Pack a color into this view's byte layout
+     * @param color Color to pack
+     * @param packed Receives bytesPerPixel(format) bytes
+     */
+    void packPixel(const RGBColor& color, uint8_t* packed) const {
+        switch (format) {
+            case PixelFormat::RGB8:
+                packed[0] = color.red; packed[1] = color.green; packed[2] = color.blue;
+                break;
+            case PixelFormat::BGRA8:
+                packed[0] = color.blue; packed[1] = color.green; packed[2] = color.red; packed[3] = color.alpha;
+                break;
+            default:
+                packed[0] = color.red; packed[1] = color.green; packed[2] = color.blue; packed[3] = color.alpha;
+                break;
+        }
+    }
+};
+
+} // namespace Utils
+} // namespace ImageCompression 
\ No newline at end of file
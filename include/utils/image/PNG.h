@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
@@ -21,6 +22,18 @@ namespace Utils {
  * 
  * Modern C++17 implementation providing efficient PNG image operations
  * with RAII memory management and exception-safe operations.
+ * 
+ * Pixel storage is reference-counted and copy-on-write: copying a PNG just
+ * shares the buffer, and the first mutating call on a shared image (the
+ * non-const getPixel(), getPixelData(), normalizeColors()) takes a private
+ * copy. Passing images around by value is O(1); only real edits pay for a copy.
+ * 
+ * Because of that, pointers from getPixel() and getPixelData() are only valid
+ * until the next mutating call on the same image - if the buffer was shared at
+ * that point, the image moves to a fresh copy and older pointers keep pointing
+ * at the other images' pixels. Copies can be used from different threads, but
+ * a single PNG object still must not be mutated from two threads at once;
+ * threads filling one image should share a pointer from getPixelData().
  */
 class PNG {
 public:
@@ -37,7 +50,7 @@ public:
     PNG(unsigned int width, unsigned int height);
 
     /**
-     * @brief Copy constructor
+     * @brief Copy constructor - shares the pixels until either image is modified
      * @param other PNG image to copy
      */
     PNG(const PNG& other);
@@ -54,7 +67,7 @@ public:
     ~PNG();
 
     /**
-     * @brief Copy assignment operator
+     * @brief Copy assignment operator - shares the pixels until either image is modified
      * @param other PNG image to copy
      * @return Reference to this image
      */
@@ -69,6 +82,8 @@ public:
 
     /**
      * @brief Equality comparison operator
+     * 
+     * Same as equalsExact() - transitive, and no trig per pixel.
      * @param other PNG image to compare with
      * @return True if images are identical
      */
@@ -98,7 +113,27 @@ public:
     bool saveToFile(const std::string& filename);
 
     /**
-     * @brief Get pixel at specified coordinates
+     * @brief Load PNG image from encoded bytes already in memory
+     * @param data Start of the PNG file contents
+     * @param size Number of bytes
+     * @return True if successfully loaded
+     * @throws std::runtime_error if the bytes are not a valid PNG
+     */
+    bool loadFromMemory(const unsigned char* data, size_t size);
+
+    /**
+     * @brief Encode PNG image into a byte buffer instead of a file
+     * @param encoded Receives the PNG file contents (previous contents are replaced)
+     * @return True if successfully encoded
+     * @throws std::runtime_error if the image cannot be encoded
+     */
+    bool saveToMemory(std::vector<unsigned char>& encoded) const;
+
+    /**
+     * @brief Get pixel at specified coordinates for modification
+     * 
+     * Takes a private copy of the pixels first if they are shared with
+     * another image, which invalidates pointers handed out earlier.
      * @param x X coordinate (0 = leftmost)
      * @param y Y coordinate (0 = topmost)
      * @return Pointer to pixel (nullptr if out of bounds)
@@ -113,6 +148,17 @@ public:
      */
     const HSLAPixel* getPixel(unsigned int x, unsigned int y) const;
 
+    /**
+     * @brief Get all the pixels for modification in one go
+     * 
+     * Takes a private copy first if the pixels are shared, like the
+     * non-const getPixel(), but only once - loops that write many pixels
+     * (possibly from several threads) should use this instead of calling
+     * getPixel() per pixel. Pixels are stored row by row, width per row.
+     * @return Pointer to the top-left pixel (nullptr for an empty image)
+     */
+    HSLAPixel* getPixelData();
+
     /**
      * @brief Get image width
      * @return Width in pixels
@@ -144,11 +190,38 @@ public:
      */
     void resize(unsigned int newWidth, unsigned int newHeight);
 
+    /**
+     * @brief Check whether two images would save as exactly the same pixels
+     * 
+     * Compares the 8-bit RGBA values each image would be encoded as, so two
+     * images that only differ by rounding noise in their HSLA doubles count
+     * as equal. Stops at the first chunk that differs.
+     * @param other PNG image to compare with
+     * @return True if the dimensions and every RGBA8 value match
+     */
+    bool equalsExact(const PNG& other) const;
+
+    /**
+     * @brief Check whether two images match within a per-channel tolerance
+     * 
+     * Compares the 8-bit RGBA values each image would be encoded as. The
+     * inner loop is branch-free so the compiler can vectorize it, and we
+     * bail out as soon as a chunk goes over the tolerance.
+     * @param other PNG image to compare with
+     * @param maxChannelDifference Largest allowed difference in any R, G, B or A value (0-255)
+     * @return True if the dimensions match and no channel differs by more than the tolerance
+     */
+    bool equalsWithin(const PNG& other, unsigned int maxChannelDifference) const;
+
     /**
      * @brief Compute hash of image contents for comparison
-     * @return Hash value of image data
+     *
+     * Hashes the dimensions and the 8-bit RGBA pixels the image would be saved
+     * as, using FastHash (XXH64), so the value is the same on every platform and
+     * can be used for cache keys and spotting duplicates.
+     * @return 64-bit hash of the image data (0 for an empty image)
      */
-    std::size_t computeHash() const;
+    uint64_t computeHash() const;
 
     /**
      * @brief Apply color space normalization
@@ -161,13 +234,35 @@ public:
 private:
     unsigned int width_;                           ///< Image width in pixels
     unsigned int height_;                          ///< Image height in pixels
-    std::unique_ptr<HSLAPixel[]> imageData_;      ///< Pixel data array
+    std::shared_ptr<HSLAPixel[]> imageData_;      ///< Pixel data array, shared between copies
     
     /**
-     * @brief Copy pixel data from another PNG
-     * @param other Source PNG to copy from
+     * @brief Give this image its own copy of the pixels if other images share them
+     */
+    void detach();
+
+    /**
+     * @brief Replace the image with decoded 8-bit RGBA data
+     * @param byteData Pixels as R, G, B, A bytes, row by row
+     * @param width Image width in pixels
+     * @param height Image height in pixels
+     */
+    void setFromRGBA(const std::vector<unsigned char>& byteData, unsigned int width, unsigned int height);
+
+    /**
+     * @brief Convert the image to 8-bit RGBA data for encoding
+     * @param byteData Receives width * height * 4 bytes
+     * @throws std::runtime_error if the image is empty
+     */
+    void toRGBA(std::vector<unsigned char>& byteData) const;
+
+    /**
+     * @brief Convert a run of pixels to 8-bit RGBA
+     * @param start Index of the first pixel
+     * @param count Number of pixels to convert
+     * @param byteData Receives count * 4 bytes
      */
-    void copyFrom(const PNG& other);
+    void toRGBA(size_t start, size_t count, unsigned char* byteData) const;
 
     /**
      * @brief Validate coordinates are within image bounds
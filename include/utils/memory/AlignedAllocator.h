@@ -0,0 +1,126 @@
+/**
+ * @file AlignedAllocator.h
+ * @brief Cache-line aligned, huge-page friendly allocation for big buffers
+ *
+ * The summed-area tables and pixel arrays of a large image run to hundreds
+ * of megabytes and get read in random order, so with plain 4 KB pages most
+ * of the time goes to page faults and TLB misses. Everything allocated here
+ * starts on a 64-byte cache line. Blocks of 2 MB and up are mapped directly
+ * and 2 MB aligned, and the kernel is asked to back them with huge pages.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include "MemoryAccounting.h"
+
+namespace ImageCompression {
+namespace Utils {
+
+/// Alignment of every block - one cache line
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+/// Blocks at least this big are mapped separately and backed by huge pages
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/**
+ * @brief How large blocks should be set up
+ */
+struct LargeAllocationPolicy {
+    bool transparentHugePages = true;   ///< madvise(MADV_HUGEPAGE) on large blocks
+    bool explicitHugePages = false;     ///< Try MAP_HUGETLB first (needs pages reserved in /proc/sys/vm/nr_hugepages)
+    unsigned int prefaultThreads = 0;   ///< Touch every page of a new large block with this many threads (0 = leave it to first use)
+};
+
+/**
+ * @brief Change how large blocks are allocated from now on
+ *
+ * Set it up once at startup - blocks already handed out keep the settings
+ * they were made with, and this isn't meant to race with allocations.
+ * @param policy New settings
+ */
+void setLargeAllocationPolicy(const LargeAllocationPolicy& policy);
+
+/**
+ * @brief Get the current large block settings
+ * @return Current policy
+ */
+LargeAllocationPolicy getLargeAllocationPolicy();
+
+/**
+ * @brief Allocate a 64-byte aligned block
+ * @param bytes Size of the block
+ * @return Start of the block
+ * @throws std::bad_alloc if the memory isn't available
+ */
+void* allocateAligned(size_t bytes);
+
+/**
+ * @brief Free a block from allocateAligned()
+ * @param block Start of the block (nullptr is ignored)
+ * @param bytes The size it was allocated with
+ */
+void deallocateAligned(void* block, size_t bytes) noexcept;
+
+/**
+ * @brief Fault in every page of a block up front, spread over several threads
+ *
+ * Page faults are otherwise taken one at a time by whichever thread first
+ * writes each page. Writes a zero byte to each page, so only use it on
+ * memory whose contents don't matter yet.
+ * @param block Start of the block
+ * @param bytes Size of the block
+ * @param threads Number of threads to use
+ */
+void prefaultPages(void* block, size_t bytes, unsigned int threads);
+
+/**
+ * @brief Standard allocator that uses allocateAligned()
+ *
+ * Drop-in for std::allocator, e.g. in AlignedVector. Every block is
+ * counted against Owner in the memory accounting.
+ */
+template <typename T, MemoryOwner Owner = MemoryOwner::Other>
+class AlignedAllocator {
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Owner>;
+    };
+
+    AlignedAllocator() noexcept = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Owner>&) noexcept {}
+
+    T* allocate(size_t count) {
+        if (count > static_cast<size_t>(-1) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        T* block = static_cast<T*>(allocateAligned(count * sizeof(T)));
+        recordAllocation(Owner, count * sizeof(T));
+        return block;
+    }
+
+    void deallocate(T* block, size_t count) noexcept {
+        recordRelease(Owner, count * sizeof(T));
+        deallocateAligned(block, count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Owner>&) const noexcept { return true; }
+
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Owner>&) const noexcept { return false; }
+};
+
+/// std::vector whose storage comes from AlignedAllocator
+template <typename T, MemoryOwner Owner = MemoryOwner::Other>
+using AlignedVector = std::vector<T, AlignedAllocator<T, Owner>>;
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file
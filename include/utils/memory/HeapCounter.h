@@ -0,0 +1,44 @@
+/**
+ * @file HeapCounter.h
+ * @brief Counts calls to the global operator new, for checking hot paths stay off the heap
+ *
+ * The compress tool replaces operator new and delete with versions that
+ * count while a HeapAllocationCount is open and otherwise just call
+ * malloc and free. The library doesn't include them - replacing operator
+ * new is the program's call, not a library's - so this is only for the
+ * tool itself (the benchmark uses it).
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace ImageCompression {
+namespace Utils {
+
+/**
+ * @brief Counts heap allocations made by any thread while it's alive
+ *
+ * Only one should be open at a time. Nothing is counted before the first
+ * one opens, so the tool pays one relaxed load per allocation otherwise.
+ */
+class HeapAllocationCount {
+public:
+    HeapAllocationCount();
+    ~HeapAllocationCount();
+
+    HeapAllocationCount(const HeapAllocationCount&) = delete;
+    HeapAllocationCount& operator=(const HeapAllocationCount&) = delete;
+
+    /**
+     * @brief Allocations so far, on every thread
+     * @return Calls to operator new since construction
+     */
+    size_t count() const;
+
+private:
+    size_t start_;
+};
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file
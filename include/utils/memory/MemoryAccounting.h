@@ -0,0 +1,177 @@
+/**
+ * @file MemoryAccounting.h
+ * @brief Byte counts for the big buffers, split by what they're for
+ *
+ * The allocator layer and the PNG codec report every large buffer they
+ * hand out or free here, so a compression can say how much memory it
+ * actually needed instead of us guessing. Counters are per thread: a
+ * compression's numbers aren't mixed up with other images being
+ * compressed at the same time. Parts of a compression that run on
+ * helper threads are handed back to the thread that started it (see
+ * MemoryHandOff).
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ImageCompression {
+namespace Utils {
+
+/**
+ * @brief What a tracked buffer is used for
+ */
+enum class MemoryOwner {
+    PngPixels,          ///< HSLA pixel arrays inside PNG objects
+    StatisticsTables,   ///< ImageStatistics summed-area tables
+    TreeNodes,          ///< AdaptiveImageTree nodes
+    CodecBuffers,       ///< RGBA and encoded byte buffers while decoding/encoding PNGs
+    Other               ///< Aligned allocations nobody labelled
+};
+
+/// Number of MemoryOwner values
+constexpr size_t MEMORY_OWNER_COUNT = 5;
+
+/**
+ * @brief Get a short human-readable name for an owner
+ * @param owner Owner to name
+ * @return Name such as "pixels" or "statistics"
+ */
+const char* memoryOwnerName(MemoryOwner owner);
+
+/**
+ * @brief Memory a piece of work needed, from the tracked buffers
+ */
+struct MemoryUsage {
+    size_t peakBytes = 0;                                   ///< Highest total of all owners at any one time
+    size_t peakBytesByOwner[MEMORY_OWNER_COUNT] = {};       ///< Each owner's own high point
+    size_t allocationsByOwner[MEMORY_OWNER_COUNT] = {};     ///< Buffers handed out, per owner
+
+    /**
+     * @brief Look up one owner's peak
+     * @param owner Which owner
+     * @return Peak bytes for that owner
+     */
+    size_t peakFor(MemoryOwner owner) const { return peakBytesByOwner[static_cast<size_t>(owner)]; }
+};
+
+/**
+ * @brief Count a new buffer against the calling thread
+ * @param owner What the buffer is for
+ * @param bytes Size of the buffer
+ */
+void recordAllocation(MemoryOwner owner, size_t bytes);
+
+/**
+ * @brief Count a buffer as freed on the calling thread
+ * @param owner What the buffer was for
+ * @param bytes Size of the buffer
+ */
+void recordRelease(MemoryOwner owner, size_t bytes);
+
+/**
+ * @brief Measures the memory used by everything the calling thread does while it exists
+ *
+ * Scopes nest: only the outermost one on a thread starts a new measurement
+ * (peaks restart from whatever is allocated right now), so an entry point
+ * that calls another one still gets one measurement covering both.
+ */
+class MemoryUsageScope {
+public:
+    MemoryUsageScope();
+    ~MemoryUsageScope();
+
+    MemoryUsageScope(const MemoryUsageScope&) = delete;
+    MemoryUsageScope& operator=(const MemoryUsageScope&) = delete;
+
+    /**
+     * @brief Get the usage measured so far
+     * @return Peaks and allocation counts since the outermost scope started
+     */
+    MemoryUsage usage() const;
+};
+
+/**
+ * @brief Charges a buffer to an owner for as long as this object lives
+ *
+ * For buffers we don't allocate ourselves, like std::vectors handed to lodepng.
+ */
+class ScopedMemoryCharge {
+public:
+    ScopedMemoryCharge(MemoryOwner owner, size_t bytes) : owner_(owner), bytes_(bytes) {
+        recordAllocation(owner_, bytes_);
+    }
+
+    ~ScopedMemoryCharge() { recordRelease(owner_, bytes_); }
+
+    ScopedMemoryCharge(const ScopedMemoryCharge&) = delete;
+    ScopedMemoryCharge& operator=(const ScopedMemoryCharge&) = delete;
+
+private:
+    MemoryOwner owner_;
+    size_t bytes_;
+};
+
+/**
+ * @brief Bytes and buffers some piece of work left behind on a thread
+ */
+struct MemoryDelta {
+    int64_t bytes[MEMORY_OWNER_COUNT] = {};          ///< Still held at the end, per owner (negative = freed more)
+    size_t allocations[MEMORY_OWNER_COUNT] = {};     ///< Buffers handed out, per owner
+
+    MemoryDelta& operator+=(const MemoryDelta& other) {
+        for (size_t i = 0; i < MEMORY_OWNER_COUNT; ++i) {
+            bytes[i] += other.bytes[i];
+            allocations[i] += other.allocations[i];
+        }
+        return *this;
+    }
+};
+
+/**
+ * @brief Keeps work a thread does for someone else out of its own counters
+ *
+ * A helper thread wraps each piece of borrowed work in one of these. The
+ * work starts from empty counters (so a compression it runs gets its own
+ * measurement even inside one of ours), and finish() hands back what it
+ * still holds so the thread it was done for can take it over with
+ * absorbMemory(). The helper's own counters, peaks included, end up as
+ * if the work never ran here.
+ */
+class MemoryHandOff {
+public:
+    MemoryHandOff();
+
+    MemoryHandOff(const MemoryHandOff&) = delete;
+    MemoryHandOff& operator=(const MemoryHandOff&) = delete;
+
+    /**
+     * @brief Put the calling thread's own counters back
+     * @return What the work allocated (and still holds) since construction
+     */
+    MemoryDelta finish();
+
+private:
+    int64_t currentBytes_[MEMORY_OWNER_COUNT];
+    int64_t peakBytes_[MEMORY_OWNER_COUNT];
+    int64_t currentTotal_;
+    int64_t peakTotal_;
+    size_t allocations_[MEMORY_OWNER_COUNT];
+    int openScopes_;
+};
+
+/**
+ * @brief Count memory another thread allocated on our behalf against the calling thread
+ * @param delta What a MemoryHandOff returned
+ */
+void absorbMemory(const MemoryDelta& delta);
+
+/**
+ * @brief Get the process's peak resident set size so far
+ * @return Peak RSS in bytes (0 if the system can't tell us)
+ */
+size_t getPeakResidentBytes();
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file
@@ -0,0 +1,120 @@
+/**
+ * @file PerfCounters.h
+ * @brief Hardware performance counters around pieces of work
+ *
+ * Wraps Linux perf_event_open so we can see cycles, instructions, cache
+ * and TLB misses for each stage instead of only wall time. Counting is
+ * off until enablePerfCounters() is called, and everything degrades to
+ * "not available" when the kernel, the VM or the permissions
+ * (/proc/sys/kernel/perf_event_paranoid) don't allow it.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ImageCompression {
+namespace Utils {
+
+/**
+ * @brief Events we count
+ */
+enum class PerfEvent {
+    Cycles,         ///< CPU cycles
+    Instructions,   ///< Instructions retired
+    CacheMisses,    ///< Last-level cache misses
+    DtlbMisses,     ///< Data TLB read misses
+    BranchMisses    ///< Mispredicted branches
+};
+
+/// Number of PerfEvent values
+constexpr size_t PERF_EVENT_COUNT = 5;
+
+/**
+ * @brief Get a short name for an event, for reports
+ * @param event Event to name
+ * @return Name such as "cycles" or "llc-misses"
+ */
+const char* perfEventName(PerfEvent event);
+
+/**
+ * @brief A set of counter readings, or the difference between two
+ */
+struct PerfCounterValues {
+    uint64_t counts[PERF_EVENT_COUNT] = {};     ///< Count per event
+    bool available[PERF_EVENT_COUNT] = {};      ///< Whether each event could be counted
+
+    /**
+     * @brief Look up one event's count
+     * @param event Which event
+     * @return Count (0 if unavailable)
+     */
+    uint64_t get(PerfEvent event) const { return counts[static_cast<size_t>(event)]; }
+
+    /**
+     * @brief Check whether an event was counted
+     * @param event Which event
+     * @return True if the count is real
+     */
+    bool has(PerfEvent event) const { return available[static_cast<size_t>(event)]; }
+
+    /**
+     * @brief Check whether any event was counted
+     * @return True if at least one count is real
+     */
+    bool any() const;
+
+    /**
+     * @brief Instructions per cycle
+     * @return IPC, or 0 if either count is missing
+     */
+    double instructionsPerCycle() const;
+
+    /**
+     * @brief Work out what happened between this reading and a later one
+     * @param later Reading taken afterwards
+     * @return Per-event difference; only events available in both are kept
+     */
+    PerfCounterValues until(const PerfCounterValues& later) const;
+
+    /**
+     * @brief Add another set of counts to this one
+     * @param other Counts to add
+     * @return Reference to this
+     */
+    PerfCounterValues& operator+=(const PerfCounterValues& other);
+};
+
+/**
+ * @brief Turn counting on for the whole process
+ *
+ * Each thread opens its own counters the first time it reads them.
+ * @return True if at least one event can be counted on this thread
+ */
+bool enablePerfCounters();
+
+/**
+ * @brief Check whether counting has been turned on
+ * @return True after enablePerfCounters()
+ */
+bool perfCountersEnabled();
+
+/**
+ * @brief Explain why events are missing, if any are
+ * @return Empty when everything is counted, otherwise a short reason
+ */
+std::string perfCountersUnavailableReason();
+
+/**
+ * @brief Read the calling thread's counters
+ *
+ * Counts only user-space work on this thread. Scaled up if the kernel had
+ * to time-share the hardware counters between events.
+ * @return Current readings (nothing available when counting is off)
+ */
+PerfCounterValues readPerfCounters();
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file
@@ -0,0 +1,195 @@
+/**
+ * @file TaskScheduler.h
+ * @brief One shared work-stealing thread pool for all parallel work
+ *
+ * Files in a batch, subtrees of the adaptive tree and row bands of the
+ * summed-area tables all split their work through here, so nesting one
+ * inside another never starts more threads than getThreadLimit() allows.
+ * Each worker keeps its own deque of tasks: it runs the newest one itself
+ * and idle workers steal the oldest (biggest) ones. A thread waiting on a
+ * TaskGroup runs its own queued tasks or steals other workers' instead of
+ * blocking, which is what keeps nested parallelism from deadlocking. It
+ * never picks up someone else's work from the shared queue (the files of
+ * a batch), so a thread only ever has one image in flight, and when there
+ * is nothing it may take it sleeps until there is.
+ *
+ * Tasks are intrusive: the scheduler only links a Task into a queue, so
+ * the closure lives wherever its owner put it. parallelInvoke and
+ * parallelFor keep theirs on the joining thread's stack, which is why
+ * forking allocates nothing.
+ *
+ * With a thread limit of 1 everything runs inline on the calling thread,
+ * in the same order the serial code would.
+ */
+
+#pragma once
+
+#include "../memory/MemoryAccounting.h"
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <type_traits>
+
+namespace ImageCompression {
+namespace Utils {
+
+class TaskGroup;
+
+/**
+ * @brief One piece of queued work - subclass it, or use TaskGroup::run(std::function)
+ *
+ * The owner keeps the task alive until the group it was run in has been
+ * waited on. Queue links live in the task itself.
+ */
+class Task {
+public:
+    Task() = default;
+    virtual ~Task() = default;
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+protected:
+    /**
+     * @brief The work itself
+     */
+    virtual void execute() = 0;
+
+    /**
+     * @brief Called once execute() is over, before the group hears the task is done
+     *
+     * Tasks that own themselves delete themselves here, so whatever they
+     * captured is gone by the time wait() returns.
+     */
+    virtual void finished() {}
+
+private:
+    friend class TaskScheduler;
+    friend class TaskGroup;
+
+    TaskGroup* group_ = nullptr;
+    Task* previous_ = nullptr;
+    Task* next_ = nullptr;
+};
+
+/**
+ * @brief A task that calls something the caller keeps alive (usually a lambda on its stack)
+ */
+template <typename Function>
+class FunctionRefTask : public Task {
+public:
+    explicit FunctionRefTask(Function& function) : function_(function) {}
+
+protected:
+    void execute() override { function_(); }
+
+private:
+    Function& function_;
+};
+
+/**
+ * @brief A set of tasks that can be waited on together (fork/join)
+ *
+ * Memory the tasks allocate is counted against the thread that waits,
+ * whichever thread they actually ran on. Hardware counters
+ * (PerfCounters) only ever see the calling thread's share.
+ */
+class TaskGroup {
+public:
+    TaskGroup();
+
+    /**
+     * @brief Waits for anything still running (exceptions are dropped)
+     */
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    /**
+     * @brief Queue a task - it may start on another thread straight away
+     * @param task Work to do; it and anything it refers to must outlive wait()
+     */
+    void run(Task& task);
+
+    /**
+     * @brief Queue a copy of a function - costs an allocation, so keep it for coarse work like whole files
+     * @param task Work to do; anything it refers to must outlive wait()
+     */
+    void run(std::function<void()> task);
+
+    /**
+     * @brief Run queued tasks until every task in this group has finished
+     * @throws Whatever the first failing task threw
+     */
+    void wait();
+
+private:
+    friend class TaskScheduler;
+
+    std::atomic<size_t> pending_;
+    std::mutex resultMutex_;
+    std::exception_ptr error_;
+    MemoryDelta helperMemory_;           ///< Still held by finished tasks, for wait() to take over
+
+    void waitForTasks();
+};
+
+/**
+ * @brief How many threads parallel work may use right now
+ * @return getThreadLimit(), counting the calling thread
+ */
+unsigned int parallelism();
+
+/**
+ * @brief Run two pieces of work, in parallel if there's a free thread
+ *
+ * The second one is queued as a task on this thread's stack, so nothing is allocated.
+ *
+ * @param first Runs on the calling thread
+ * @param second May be picked up by another thread
+ */
+template <typename First, typename Second>
+void parallelInvoke(First&& first, Second&& second) {
+    if (parallelism() <= 1) {
+        first();
+        second();
+        return;
+    }
+
+    // If first() throws, the group's destructor still waits for second() - and the task
+    // is declared first, so it outlives the group
+    FunctionRefTask<std::remove_reference_t<Second>> task(second);
+    TaskGroup group;
+    group.run(task);
+    first();
+    group.wait();
+}
+
+/**
+ * @brief Call body over [begin, end) split into chunks of at least grain items
+ *
+ * The range is halved recursively so idle threads steal big pieces first.
+ *
+ * @param begin First index
+ * @param end One past the last index
+ * @param grain Smallest chunk worth handing to another thread
+ * @param body Called as body(chunkBegin, chunkEnd)
+ */
+template <typename Body>
+void parallelFor(size_t begin, size_t end, size_t grain, const Body& body) {
+    grain = grain > 1 ? grain : 1;
+    if (end - begin <= grain || parallelism() <= 1) {
+        if (begin < end) body(begin, end);
+        return;
+    }
+
+    size_t middle = begin + (end - begin) / 2;
+    parallelInvoke([&]() { parallelFor(begin, middle, grain, body); },
+                   [&]() { parallelFor(middle, end, grain, body); });
+}
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file
@@ -0,0 +1,34 @@
+/**
+ * @file ThreadLimit.h
+ * @brief Process-wide cap on how many threads parallel work may use
+ *
+ * Everything that splits work across threads asks getThreadLimit() how
+ * far to go, so one setting controls the whole process - handy for
+ * benchmarking scaling and for leaving cores free on shared machines.
+ */
+
+#pragma once
+
+namespace ImageCompression {
+namespace Utils {
+
+/**
+ * @brief Number of hardware threads on this machine
+ * @return At least 1, even when the system can't tell us
+ */
+unsigned int hardwareThreadCount();
+
+/**
+ * @brief Cap the threads parallel work may use
+ * @param threads Maximum threads (0 = one per hardware thread)
+ */
+void setThreadLimit(unsigned int threads);
+
+/**
+ * @brief Get the current thread cap
+ * @return Maximum threads, always at least 1
+ */
+unsigned int getThreadLimit();
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file
@@ -0,0 +1,259 @@
+#include "../../include/benchmark/ThreadScalingBenchmark.h"
+#include "../../include/core/AdaptiveImageTree.h"
+#include "../../include/utils/hash/FastHash.h"
+#include "../../include/utils/memory/HeapCounter.h"
+#include "../../include/utils/threading/TaskScheduler.h"
+#include "../../include/utils/threading/ThreadLimit.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+namespace ImageCompression {
+
+    namespace {
+        
+        // The stages that split their work across threads, in report order
+        const PipelineStage PARALLEL_STAGES[] = {
+            PipelineStage::Statistics,
+            PipelineStage::TreeBuild,
+            PipelineStage::Render
+        };
+        
+        const char* END_TO_END = "end-to-end";
+        const char* HASH = "hash";
+
+    } // namespace
+
+    ThreadScalingBenchmark::ThreadScalingBenchmark(const BenchmarkConfig& config)
+        : config_(config) {}
+
+    std::vector<unsigned int> ThreadScalingBenchmark::threadCounts(unsigned int maxThreads) {
+        if (maxThreads == 0) maxThreads = Utils::hardwareThreadCount();
+        
+        std::vector<unsigned int> counts;
+        for (unsigned int threads = 1; threads < maxThreads; threads *= 2) {
+            counts.push_back(threads);
+        }
+        counts.push_back(maxThreads);
+        return counts;
+    }
+
+    void ThreadScalingBenchmark::loadCorpus() {
+        std::vector<std::filesystem::path> paths;
+        for (const auto& entry : std::filesystem::directory_iterator(config_.inputDirectory)) {
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            if (entry.is_regular_file() && extension == ".png") {
+                paths.push_back(entry.path());
+            }
+        }
+        
+        // Same order every time, so runs on different machines compare like for like
+        std::sort(paths.begin(), paths.end());
+        
+        corpus_.clear();
+        for (const auto& path : paths) {
+            std::ifstream file(path, std::ios::binary);
+            corpus_.emplace_back((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        }
+        
+        if (corpus_.empty()) {
+            throw std::runtime_error("No PNG files found in: " + config_.inputDirectory);
+        }
+    }
+
+    StageMetrics ThreadScalingBenchmark::measureStages() {
+        StageMetrics best;
+        for (size_t i = 0; i < PIPELINE_STAGE_COUNT; ++i) {
+            best.stages[i].wallSeconds = std::numeric_limits<double>::max();
+        }
+        
+        std::vector<uint8_t> output;
+        for (int run = 0; run < config_.repetitions; ++run) {
+            StageMetrics total;
+            for (const auto& image : corpus_) {
+                CompressionResult result = ImageCompressor::compressBuffer(image.data(), image.size(),
+                                                                           output, config_.pruningConfig);
+                total += result.stageMetrics;
+            }
+            
+            for (size_t i = 0; i < PIPELINE_STAGE_COUNT; ++i) {
+                best.stages[i].wallSeconds = std::min(best.stages[i].wallSeconds, total.stages[i].wallSeconds);
+            }
+        }
+        return best;
+    }
+
+    double ThreadScalingBenchmark::measureEndToEnd() {
+        double best = std::numeric_limits<double>::max();
+        
+        for (int run = 0; run < config_.repetitions; ++run) {
+            auto startTime = std::chrono::steady_clock::now();
+            
+            // Same as batch mode: every image is a task, sharing the threads with the stages inside it
+            Utils::TaskGroup images;
+            for (const auto& image : corpus_) {
+                images.run([this, &image]() {
+                    std::vector<uint8_t> output;
+                    ImageCompressor::compressBuffer(image.data(), image.size(), output, config_.pruningConfig);
+                });
+            }
+            images.wait();
+            
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+        }
+        return best;
+    }
+
+    double ThreadScalingBenchmark::measureHash(size_t& bytesHashed) {
+        size_t corpusBytes = 0;
+        for (const auto& image : corpus_) {
+            corpusBytes += image.size();
+        }
+        corpusBytes = std::max<size_t>(corpusBytes, 1);
+        size_t passes = (HASH_MINIMUM_BYTES + corpusBytes - 1) / corpusBytes;
+        bytesHashed = corpusBytes * passes;
+        
+        double best = std::numeric_limits<double>::max();
+        for (int run = 0; run < config_.repetitions; ++run) {
+            // Keeps the compiler from dropping hashes nobody looks at
+            std::vector<uint64_t> digests(corpus_.size());
+            
+            auto startTime = std::chrono::steady_clock::now();
+            Utils::TaskGroup images;
+            for (size_t i = 0; i < corpus_.size(); ++i) {
+                images.run([this, &digests, i, passes]() {
+                    uint64_t digest = 0;
+                    for (size_t pass = 0; pass < passes; ++pass) {
+                        digest = Utils::FastHash::hash(corpus_[i].data(), corpus_[i].size(), digest);
+                    }
+                    digests[i] = digest;
+                });
+            }
+            images.wait();
+            
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count());
+        }
+        return best;
+    }
+
+    size_t ThreadScalingBenchmark::measureTreeBuildAllocations() {
+        size_t most = 0;
+        for (const auto& image : corpus_) {
+            Utils::PNG decoded;
+            decoded.loadFromMemory(image.data(), image.size());
+            ImageStatistics statistics(decoded);
+            
+            // The first build starts the workers and fills the node pools - that's allowed to allocate
+            { AdaptiveImageTree warmUp(statistics); }
+            
+            for (int run = 0; run < config_.repetitions; ++run) {
+                Utils::HeapAllocationCount allocations;
+                { AdaptiveImageTree tree(statistics); }
+                most = std::max(most, allocations.count());
+            }
+        }
+        return most;
+    }
+
+    std::vector<ScalingSample> ThreadScalingBenchmark::run() {
+        loadCorpus();
+        
+        unsigned int previousLimit = Utils::getThreadLimit();
+        std::vector<unsigned int> counts = threadCounts(config_.maxThreads);
+        
+        // One warm-up pass so first-touch page faults and lazy tables don't land on 1 thread
+        Utils::setThreadLimit(1);
+        std::vector<uint8_t> output;
+        for (const auto& image : corpus_) {
+            ImageCompressor::compressBuffer(image.data(), image.size(), output, config_.pruningConfig);
+        }
+        
+        std::vector<ScalingSample> samples;
+        allocationSamples_.clear();
+        hashSamples_.clear();
+        std::map<std::string, double> singleThreadSeconds;
+        auto addSample = [&](const std::string& stage, unsigned int threads, double seconds) {
+            if (threads == 1) singleThreadSeconds[stage] = seconds;
+            double speedup = seconds > 0.0 ? singleThreadSeconds[stage] / seconds : 0.0;
+            samples.push_back({stage, threads, seconds, speedup, speedup / threads});
+        };
+        
+        for (unsigned int threads : counts) {
+            Utils::setThreadLimit(threads);
+            StageMetrics stages = measureStages();
+            for (PipelineStage stage : PARALLEL_STAGES) {
+                addSample(pipelineStageName(stage), threads, stages[stage].wallSeconds);
+            }
+            
+            addSample(END_TO_END, threads, measureEndToEnd());
+            
+            size_t bytesHashed = 0;
+            double hashSeconds = measureHash(bytesHashed);
+            addSample(HASH, threads, hashSeconds);
+            hashSamples_.push_back({threads, hashSeconds > 0.0 ? bytesHashed / hashSeconds / 1e9 : 0.0});
+            allocationSamples_.push_back({threads, measureTreeBuildAllocations()});
+        }
+        
+        Utils::setThreadLimit(previousLimit);
+        return samples;
+    }
+
+    void ThreadScalingBenchmark::printTables(const std::vector<ScalingSample>& samples, std::ostream& out) {
+        // Rows in the order they were measured, columns in thread order
+        std::vector<std::string> stages;
+        std::vector<unsigned int> counts;
+        for (const ScalingSample& sample : samples) {
+            if (std::find(stages.begin(), stages.end(), sample.stage) == stages.end()) stages.push_back(sample.stage);
+            if (std::find(counts.begin(), counts.end(), sample.threads) == counts.end()) counts.push_back(sample.threads);
+        }
+        
+        auto printTable = [&](const std::string& title, auto formatCell) {
+            out << title << "\n" << std::left << std::setw(12) << "threads" << std::right;
+            for (unsigned int threads : counts) {
+                out << std::setw(10) << threads;
+            }
+            out << "\n";
+            
+            for (const std::string& stage : stages) {
+                out << std::left << std::setw(12) << stage << std::right;
+                for (unsigned int threads : counts) {
+                    auto sample = std::find_if(samples.begin(), samples.end(), [&](const ScalingSample& s) {
+                        return s.stage == stage && s.threads == threads;
+                    });
+                    out << std::setw(10) << (sample != samples.end() ? formatCell(*sample) : "-");
+                }
+                out << "\n";
+            }
+            out << "\n";
+        };
+        
+        auto formatted = [](double value, int precision, const char* suffix) {
+            std::ostringstream text;
+            text << std::fixed << std::setprecision(precision) << value << suffix;
+            return text.str();
+        };
+        
+        printTable("Time (ms)", [&](const ScalingSample& s) { return formatted(s.seconds * 1000.0, 1, ""); });
+        printTable("Speedup", [&](const ScalingSample& s) { return formatted(s.speedup, 2, "x"); });
+        printTable("Efficiency", [&](const ScalingSample& s) { return formatted(s.efficiency * 100.0, 0, "%"); });
+    }
+
+    void ThreadScalingBenchmark::writeCsv(const std::vector<ScalingSample>& samples, std::ostream& out) {
+        out << "stage,threads,seconds,speedup,efficiency\n";
+        out << std::setprecision(6);
+        for (const ScalingSample& sample : samples) {
+            out << sample.stage << ',' << sample.threads << ',' << sample.seconds << ','
+                << sample.speedup << ',' << sample.efficiency << "\n";
+        }
+    }
+
+} // namespace ImageCompression 
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include "../../include/cache/ResultCache.h"
+#include "../../include/core/ImageCompressor.h"
+#include "../../include/utils/hash/FastHash.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+namespace ImageCompression {
+
+    namespace {
+        
+        const char* ENTRY_SUFFIX = ".entry";
+
+    } // namespace
+
+    ResultCache::ResultCache(const std::string& directory, uint64_t maxBytes)
+        : directory_(directory), maxBytes_(maxBytes) {
+        std::filesystem::create_directories(directory_);
+    }
+
+    std::string ResultCache::makeKey(const uint8_t* inputBytes, size_t size, const PruningConfig& config) {
+        // Settings are printed at full precision so nearby quality scores never share a key
+        std::ostringstream settings;
+        settings << std::setprecision(17) << config.minimumSimilarityPercentage << ' '
+                 << config.colorToleranceThreshold << ' ' << config.mergeAdjacentRegions << ' '
+                 << config.mergeColorTolerance << ' '
+                 << ImageCompressor::ALGORITHM_VERSION << ' ' << ENTRY_FORMAT_VERSION;
+        std::string settingsText = settings.str();
+        
+        // The settings hash is seeded with the content hash so it covers both
+        uint64_t contentHash = Utils::FastHash::hash(inputBytes, size);
+        uint64_t keyHash = Utils::FastHash::hash(settingsText.data(), settingsText.size(), contentHash);
+        
+        std::ostringstream key;
+        key << std::hex << std::setfill('0') << std::setw(16) << contentHash
+            << std::setw(16) << keyHash << std::setw(16) << size;
+        return key.str();
+    }
+
+    std::string ResultCache::entryPath(const std::string& key) const {
+        return (std::filesystem::path(directory_) / (key + ENTRY_SUFFIX)).string();
+    }
+
+    bool ResultCache::lookup(const std::string& key, std::vector<uint8_t>& pngBytes,
+                             CachedResultInfo& info) const {
+        std::string path = entryPath(key);
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+        
+        std::string header;
+        if (!std::getline(file, header)) return false;
+        
+        std::istringstream fields(header);
+        std::string magic;
+        int version = 0;
+        uint64_t pngSize = 0;
+        fields >> magic >> version >> info.compressionRatio >> info.originalPixels
+               >> info.compressedRegions >> info.processingTimeSeconds >> pngSize;
+        
+        // Only believe the size in the header if the file actually has that many bytes after it -
+        // a corrupt entry could otherwise make us allocate whatever it claims. Entries are renamed
+        // into place whole, so a bad one never fixes itself and is removed rather than kept around
+        std::streamoff pngStart = file.tellg();
+        file.seekg(0, std::ios::end);
+        std::streamoff bytesLeft = file.tellg() - pngStart;
+        if (!fields || magic != "CAICACHE" || version != ENTRY_FORMAT_VERSION ||
+            pngStart < 0 || pngSize == 0 || bytesLeft < 0 || pngSize != static_cast<uint64_t>(bytesLeft)) {
+            file.close();
+            std::error_code ignored;
+            std::filesystem::remove(path, ignored);
+            return false;
+        }
+        
+        file.seekg(pngStart);
+        pngBytes.resize(pngSize);
+        if (!file.read(reinterpret_cast<char*>(pngBytes.data()), static_cast<std::streamsize>(pngSize))) {
+            return false;
+        }
+        
+        // Mark it as recently used so eviction keeps it
+        std::error_code ignored;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ignored);
+        return true;
+    }
+
+    void ResultCache::store(const std::string& key, const std::vector<uint8_t>& pngBytes,
+                            const CachedResultInfo& info) {
+        // Unique temp name per process and thread, so concurrent writers never share a file
+        static std::atomic<uint64_t> counter(0);
+        std::ostringstream tempName;
+        tempName << key << ".tmp." << getpid() << '.' << std::hash<std::thread::id>()(std::this_thread::get_id())
+                 << '.' << counter++;
+        std::string tempPath = (std::filesystem::path(directory_) / tempName.str()).string();
+        
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            if (!file) return;
+            
+            file << "CAICACHE " << ENTRY_FORMAT_VERSION << ' ' << std::setprecision(17)
+                 << info.compressionRatio << ' ' << info.originalPixels << ' ' << info.compressedRegions
+                 << ' ' << info.processingTimeSeconds << ' ' << pngBytes.size() << '\n';
+            file.write(reinterpret_cast<const char*>(pngBytes.data()), static_cast<std::streamsize>(pngBytes.size()));
+            if (!file) {
+                file.close();
+                std::remove(tempPath.c_str());
+                return;
+            }
+        }
+        
+        // rename() replaces atomically - readers see the old entry or the new one, never half of one
+        if (std::rename(tempPath.c_str(), entryPath(key).c_str()) != 0) {
+            std::remove(tempPath.c_str());
+            return;
+        }
+        
+        evictToLimit();
+    }
+
+    void ResultCache::evictToLimit() {
+        struct Entry {
+            std::filesystem::path path;
+            uint64_t size;
+            std::filesystem::file_time_type lastUsed;
+        };
+        
+        std::vector<Entry> entries;
+        uint64_t totalBytes = 0;
+        std::error_code error;
+        for (const auto& item : std::filesystem::directory_iterator(directory_, error)) {
+            if (item.path().extension() != ENTRY_SUFFIX) continue;
+            
+            std::error_code statError;
+            uint64_t size = item.file_size(statError);
+            auto lastUsed = item.last_write_time(statError);
+            if (statError) continue;   // Someone else removed it meanwhile
+            
+            entries.push_back({item.path(), size, lastUsed});
+            totalBytes += size;
+        }
+        if (totalBytes <= maxBytes_) return;
+        
+        // Oldest first
+        std::sort(entries.begin(), entries.end(),
+                  [](const Entry& a, const Entry& b) { return a.lastUsed < b.lastUsed; });
+        
+        for (const Entry& entry : entries) {
+            if (totalBytes <= maxBytes_) break;
+            std::error_code removeError;
+            std::filesystem::remove(entry.path, removeError);
+            totalBytes -= entry.size;
+        }
+    }
+
+} // namespace ImageCompression 
\ No newline at end of file
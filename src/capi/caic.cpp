@@ -0,0 +1,170 @@
+#include "../../include/caic.h"
+#include "../../include/core/ImageCompressor.h"
+#include "../../include/statistics/ImageStatistics.h"
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace ImageCompression;
+
+// Everything one caller needs between calls - the buffers are what make reuse cheap
+struct caic_context {
+    PruningConfig config;
+    std::unique_ptr<ImageStatistics> statistics;   // Rebuilt in place for each image
+    std::vector<uint8_t> output;                   // Encoded PNG handed back by caic_compress_png
+    caic_stats stats;
+    std::string lastError;
+
+    explicit caic_context(double quality)
+        : config(ImageCompressor::getConfigForQuality(quality)), stats() {}
+};
+
+namespace {
+
+    caic_status fail(caic_context* context, caic_status status, const std::string& message) {
+        context->lastError = message;
+        return status;
+    }
+
+    bool toPixelFormat(caic_pixel_format format, Utils::PixelFormat& converted) {
+        switch (format) {
+            case CAIC_FORMAT_RGBA8: converted = Utils::PixelFormat::RGBA8; return true;
+            case CAIC_FORMAT_RGB8:  converted = Utils::PixelFormat::RGB8;  return true;
+            case CAIC_FORMAT_BGRA8: converted = Utils::PixelFormat::BGRA8; return true;
+        }
+        return false;
+    }
+
+    template <typename Source>
+    void analyze(caic_context* context, const Source& source) {
+        if (context->statistics) {
+            context->statistics->rebuild(source);
+        } else {
+            context->statistics = std::make_unique<ImageStatistics>(source);
+        }
+    }
+
+    void recordStats(caic_context* context, const CompressionResult& result) {
+        context->stats.compression_ratio = result.compressionRatio;
+        context->stats.original_pixels = result.originalPixels;
+        context->stats.compressed_regions = result.compressedRegions;
+        context->stats.processing_seconds = result.processingTimeSeconds;
+        context->lastError.clear();
+    }
+
+} // namespace
+
+extern "C" {
+
+caic_context* caic_create(double quality) {
+    try {
+        return new caic_context(quality);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void caic_destroy(caic_context* context) {
+    delete context;
+}
+
+caic_status caic_set_quality(caic_context* context, double quality) {
+    if (!context) return CAIC_ERROR_INVALID_ARGUMENT;
+    context->config = ImageCompressor::getConfigForQuality(quality);
+    return CAIC_OK;
+}
+
+caic_status caic_compress_png(caic_context* context,
+                              const uint8_t* input, size_t input_size,
+                              const uint8_t** output, size_t* output_size) {
+    if (!context) return CAIC_ERROR_INVALID_ARGUMENT;
+    if (!input || input_size == 0 || !output || !output_size) {
+        return fail(context, CAIC_ERROR_INVALID_ARGUMENT, "input, output and output_size must be set");
+    }
+
+    try {
+        Utils::PNG image;
+        try {
+            image.loadFromMemory(input, input_size);
+        } catch (const std::bad_alloc&) {
+            throw;
+        } catch (const std::exception& e) {
+            return fail(context, CAIC_ERROR_DECODE, e.what());
+        }
+        
+        analyze(context, image);
+        CompressionResult result = ImageCompressor::compressStatistics(*context->statistics, context->config);
+        
+        try {
+            result.compressedImage.saveToMemory(context->output);
+        } catch (const std::bad_alloc&) {
+            throw;
+        } catch (const std::exception& e) {
+            return fail(context, CAIC_ERROR_ENCODE, e.what());
+        }
+        
+        *output = context->output.data();
+        *output_size = context->output.size();
+        recordStats(context, result);
+        return CAIC_OK;
+    } catch (const std::bad_alloc&) {
+        return fail(context, CAIC_ERROR_OUT_OF_MEMORY, "out of memory");
+    } catch (const std::exception& e) {
+        return fail(context, CAIC_ERROR_INTERNAL, e.what());
+    } catch (...) {
+        return fail(context, CAIC_ERROR_INTERNAL, "unknown error");
+    }
+}
+
+caic_status caic_compress_pixels(caic_context* context,
+                                 const uint8_t* input, uint32_t width, uint32_t height,
+                                 size_t input_stride, caic_pixel_format input_format,
+                                 uint8_t* output, size_t output_stride,
+                                 caic_pixel_format output_format) {
+    if (!context) return CAIC_ERROR_INVALID_ARGUMENT;
+
+    Utils::PixelFormat inputFormat, outputFormat;
+    if (!input || !output || width == 0 || height == 0 ||
+        !toPixelFormat(input_format, inputFormat) || !toPixelFormat(output_format, outputFormat)) {
+        return fail(context, CAIC_ERROR_INVALID_ARGUMENT, "invalid buffer, size or pixel format");
+    }
+
+    try {
+        Utils::ImageView inputView(input, width, height, input_stride, inputFormat);
+        Utils::MutableImageView outputView(output, width, height, output_stride, outputFormat);
+        if (inputView.stride < width * Utils::bytesPerPixel(inputFormat) ||
+            outputView.stride < width * Utils::bytesPerPixel(outputFormat)) {
+            return fail(context, CAIC_ERROR_INVALID_ARGUMENT, "stride is smaller than a row of pixels");
+        }
+        
+        analyze(context, inputView);
+        CompressionResult result = ImageCompressor::compressStatistics(*context->statistics, context->config,
+                                                                      outputView);
+        recordStats(context, result);
+        return CAIC_OK;
+    } catch (const std::bad_alloc&) {
+        return fail(context, CAIC_ERROR_OUT_OF_MEMORY, "out of memory");
+    } catch (const std::exception& e) {
+        return fail(context, CAIC_ERROR_INTERNAL, e.what());
+    } catch (...) {
+        return fail(context, CAIC_ERROR_INTERNAL, "unknown error");
+    }
+}
+
+caic_status caic_get_stats(const caic_context* context, caic_stats* stats) {
+    if (!context || !stats) return CAIC_ERROR_INVALID_ARGUMENT;
+    *stats = context->stats;
+    return CAIC_OK;
+}
+
+const char* caic_last_error(const caic_context* context) {
+    return context ? context->lastError.c_str() : "null context";
+}
+
+int caic_api_version(void) {
+    return CAIC_API_VERSION;
+}
+
+} // extern "C" 
\ No newline at end of file
@@ -1,26 +1,231 @@
 #include "../../include/core/AdaptiveImageTree.h"
+#include "../../include/statistics/SquaredErrorTable.h"
+#include "../../include/utils/memory/AlignedAllocator.h"
+#include "../../include/utils/threading/TaskScheduler.h"
 #include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <chrono>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <numeric>
+#include <queue>
+#include <stdexcept>
 
 namespace ImageCompression {
 
-    AdaptiveImageTree::AdaptiveImageTree(const Utils::PNG& inputImage) 
-        : imageWidth_(inputImage.getWidth()), imageHeight_(inputImage.getHeight()) {
+    namespace {
+        
+        // Recycles tree nodes so building a tree doesn't go to the heap once per node.
+        // Each thread has its own free list, refilled a slab at a time. Nodes can be
+        // freed on a different thread than they came from - subtrees are built on
+        // worker threads and freed wherever the tree dies - so they just join that
+        // thread's list, and once a list holds more than two slabs' worth a slab's
+        // worth goes back to a shared stack the other threads refill from. Slabs are
+        // never given back to the system, only reused. When a thread exits, its
+        // spare nodes go to the shared stack too.
+        struct FreeNode {
+            FreeNode* next;
+        };
+        
+        struct FreeBatch {
+            FreeNode* head;
+            size_t count;
+        };
+        
+        constexpr size_t NODES_PER_SLAB = 4096;
+        
+        std::mutex sharedPoolMutex;
+        std::vector<FreeBatch> sharedBatches;
+        std::vector<void*> allSlabs;   // Keeps the slabs reachable for leak checkers
+        
+        class NodePool {
+        public:
+            ~NodePool() {
+                if (!freeNodes_) return;
+                std::lock_guard<std::mutex> lock(sharedPoolMutex);
+                sharedBatches.push_back({freeNodes_, freeCount_});
+            }
+            
+            void* allocate(size_t nodeSize) {
+                if (!freeNodes_) refill(nodeSize);
+                FreeNode* node = freeNodes_;
+                freeNodes_ = node->next;
+                freeCount_--;
+                return node;
+            }
+            
+            void release(void* block) {
+                push(static_cast<FreeNode*>(block));
+                if (freeCount_ >= 2 * NODES_PER_SLAB) giveBack();
+            }
+            
+        private:
+            FreeNode* freeNodes_ = nullptr;
+            size_t freeCount_ = 0;
+            
+            void push(FreeNode* node) {
+                node->next = freeNodes_;
+                freeNodes_ = node;
+                freeCount_++;
+            }
+            
+            // Hand a slab's worth of spare nodes to whichever thread runs dry next
+            void giveBack() {
+                FreeNode* last = freeNodes_;
+                for (size_t i = 1; i < NODES_PER_SLAB; ++i) last = last->next;
+                
+                FreeBatch batch{freeNodes_, NODES_PER_SLAB};
+                freeNodes_ = last->next;
+                freeCount_ -= NODES_PER_SLAB;
+                last->next = nullptr;
+                
+                std::lock_guard<std::mutex> lock(sharedPoolMutex);
+                sharedBatches.push_back(batch);
+            }
+            
+            void refill(size_t nodeSize) {
+                std::lock_guard<std::mutex> lock(sharedPoolMutex);
+                if (!sharedBatches.empty()) {
+                    freeNodes_ = sharedBatches.back().head;
+                    freeCount_ = sharedBatches.back().count;
+                    sharedBatches.pop_back();
+                    return;
+                }
+                
+                char* slab = static_cast<char*>(Utils::allocateAligned(NODES_PER_SLAB * nodeSize));
+                allSlabs.push_back(slab);
+                for (size_t i = NODES_PER_SLAB; i-- > 0; ) {
+                    push(reinterpret_cast<FreeNode*>(slab + i * nodeSize));
+                }
+            }
+        };
+        
+        thread_local NodePool nodePool;
+        
+    } // namespace
+
+    void* AdaptiveImageTree::TreeNode::operator new(size_t size) {
+        static_assert(sizeof(TreeNode) >= sizeof(FreeNode), "free list links live inside spare nodes");
+        static_assert(alignof(TreeNode) <= Utils::CACHE_LINE_SIZE, "slabs are only cache-line aligned");
+        assert(size == sizeof(TreeNode));
+        (void)size;
+        Utils::recordAllocation(Utils::MemoryOwner::TreeNodes, sizeof(TreeNode));
+        return nodePool.allocate(sizeof(TreeNode));
+    }
+
+    void AdaptiveImageTree::TreeNode::operator delete(void* node) noexcept {
+        if (!node) return;
+        Utils::recordRelease(Utils::MemoryOwner::TreeNodes, sizeof(TreeNode));
+        nodePool.release(node);
+    }
+
+    AdaptiveImageTree::AdaptiveImageTree(const Utils::PNG& inputImage, const BuildConfig& buildConfig) 
+        : imageWidth_(inputImage.getWidth()), imageHeight_(inputImage.getHeight()), mergedRegionCount_(0),
+          budgetExhausted_(false) {
         
         // Build statistics for the entire image
         ImageStatistics statistics(inputImage);
         
+        buildTree(statistics, buildConfig);
+    }
+
+    AdaptiveImageTree::AdaptiveImageTree(const ImageStatistics& statistics, const BuildConfig& buildConfig)
+        : imageWidth_(statistics.getWidth()), imageHeight_(statistics.getHeight()), mergedRegionCount_(0),
+          budgetExhausted_(false) {
+        
+        buildTree(statistics, buildConfig);
+    }
+
+    void AdaptiveImageTree::buildTree(const ImageStatistics& statistics, const BuildConfig& buildConfig) {
         // Create the root rectangle covering the entire image
         Rectangle rootRegion(0, 0, imageWidth_ - 1, imageHeight_ - 1);
         
+        if (buildConfig.hasBudget()) {
+            rootNode_ = buildTreeBestFirst(statistics, rootRegion, buildConfig);
+            return;
+        }
+        
         // Recursively build the tree
         rootNode_ = buildTreeRecursive(statistics, rootRegion);
     }
 
+    std::unique_ptr<AdaptiveImageTree::TreeNode>
+    AdaptiveImageTree::buildTreeBestFirst(const ImageStatistics& statistics,
+                                          const Rectangle& region,
+                                          const BuildConfig& buildConfig) {
+        auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>(buildConfig.timeBudgetSeconds));
+        
+        // Leaves that could still be split, most detailed first
+        struct Candidate {
+            double detail;
+            TreeNode* node;
+            
+            bool operator<(const Candidate& other) const { return detail < other.detail; }
+        };
+        std::priority_queue<Candidate> candidates;
+        
+        // Same stopping rules as buildTreeRecursive - anything they'd stop at never gets queued.
+        // Only final leaves read the color tables; queued ones wait until we know they stay leaves
+        auto addLeaf = [&](std::unique_ptr<TreeNode>& slot, const Rectangle& leafRegion) {
+            slot = std::make_unique<TreeNode>(leafRegion);
+            if (leafRegion.upperLeft != leafRegion.lowerRight && !statistics.isFullyTransparent(leafRegion)) {
+                double entropy = statistics.calculateEntropy(leafRegion);
+                if (entropy >= 0.1) {
+                    candidates.push({entropy * getRegionArea(leafRegion), slot.get()});
+                    return;
+                }
+            }
+            slot->colorSums = statistics.getColorSums(leafRegion);
+        };
+        
+        std::unique_ptr<TreeNode> root;
+        addLeaf(root, region);
+        
+        size_t regions = 1;
+        for (size_t splits = 0; !candidates.empty(); ++splits) {
+            bool outOfRegions = buildConfig.maxRegions > 0 && regions >= buildConfig.maxRegions;
+            bool outOfTime = buildConfig.timeBudgetSeconds > 0.0 && splits % BUDGET_CHECK_INTERVAL == 0 &&
+                             std::chrono::steady_clock::now() >= deadline;
+            if (outOfRegions || outOfTime) {
+                budgetExhausted_ = true;
+                break;
+            }
+            
+            TreeNode* node = candidates.top().node;
+            candidates.pop();
+            
+            auto splitResult = findOptimalSplit(statistics, node->region);
+            addLeaf(node->leftChild, splitResult.first);
+            addLeaf(node->rightChild, splitResult.second);
+            regions++;
+        }
+        
+        // Whatever's still waiting to be split stays a leaf
+        for (; !candidates.empty(); candidates.pop()) {
+            TreeNode* leaf = candidates.top().node;
+            leaf->colorSums = statistics.getColorSums(leaf->region);
+        }
+        
+        sumChildColors(root.get());
+        return root;
+    }
+
+    void AdaptiveImageTree::sumChildColors(TreeNode* node) {
+        if (!node->leftChild || !node->rightChild) return;
+        
+        sumChildColors(node->leftChild.get());
+        sumChildColors(node->rightChild.get());
+        node->colorSums = node->leftChild->colorSums;
+        node->colorSums += node->rightChild->colorSums;
+    }
+
     AdaptiveImageTree::AdaptiveImageTree(const AdaptiveImageTree& other) 
-        : imageWidth_(other.imageWidth_), imageHeight_(other.imageHeight_) {
+        : imageWidth_(other.imageWidth_), imageHeight_(other.imageHeight_),
+          mergedRegionCount_(other.mergedRegionCount_), budgetExhausted_(other.budgetExhausted_) {
         rootNode_ = copyTreeRecursive(other.rootNode_.get());
     }
 
@@ -28,6 +233,8 @@ namespace ImageCompression {
         if (this != &rhs) {
             imageWidth_ = rhs.imageWidth_;
             imageHeight_ = rhs.imageHeight_;
+            mergedRegionCount_ = rhs.mergedRegionCount_;
+            budgetExhausted_ = rhs.budgetExhausted_;
             rootNode_ = copyTreeRecursive(rhs.rootNode_.get());
         }
         return *this;
@@ -37,20 +244,25 @@ namespace ImageCompression {
     AdaptiveImageTree::buildTreeRecursive(const ImageStatistics& statistics, 
                                          const Rectangle& region) {
         
-        // Get average color for this region
-        Utils::HSLAPixel averageColor = statistics.getAverageColor(region);
-        
         // Create node for this region
-        auto currentNode = std::make_unique<TreeNode>(region, averageColor);
+        auto currentNode = std::make_unique<TreeNode>(region);
         
         // Base case: single pixel region
         if (region.upperLeft == region.lowerRight) {
+            currentNode->colorSums = statistics.getColorSums(region);
+            return currentNode;
+        }
+        
+        // Nothing visible in here, so there's nothing worth splitting - one cheap lookup
+        if (statistics.isFullyTransparent(region)) {
+            currentNode->colorSums = statistics.getColorSums(region);
             return currentNode;
         }
         
         // Early termination: if region has very low entropy (uniform color), don't split
         double regionEntropy = statistics.calculateEntropy(region);
         if (regionEntropy < 0.1) {  // Very uniform region
+            currentNode->colorSums = statistics.getColorSums(region);
             return currentNode;
         }
         
@@ -59,13 +271,76 @@ namespace ImageCompression {
         Rectangle leftRegion = splitResult.first;
         Rectangle rightRegion = splitResult.second;
         
-        // Recursively build left and right subtrees
-        currentNode->leftChild = buildTreeRecursive(statistics, leftRegion);
-        currentNode->rightChild = buildTreeRecursive(statistics, rightRegion);
+        // Recursively build left and right subtrees - big ones on two threads if there's one free
+        if (getRegionArea(region) >= PARALLEL_MIN_PIXELS) {
+            Utils::parallelInvoke(
+                [&]() { currentNode->leftChild = buildTreeRecursive(statistics, leftRegion); },
+                [&]() { currentNode->rightChild = buildTreeRecursive(statistics, rightRegion); });
+        } else {
+            currentNode->leftChild = buildTreeRecursive(statistics, leftRegion);
+            currentNode->rightChild = buildTreeRecursive(statistics, rightRegion);
+        }
+        
+        // Only leaves read the color tables - a split region's totals are just its halves added up
+        currentNode->colorSums = currentNode->leftChild->colorSums;
+        currentNode->colorSums += currentNode->rightChild->colorSums;
         
         return currentNode;
     }
 
+    void AdaptiveImageTree::rebuildRegions(const ImageStatistics& statistics,
+                                           const std::vector<Rectangle>& changedRegions) {
+        if (statistics.getWidth() != imageWidth_ || statistics.getHeight() != imageHeight_) {
+            // Different image size - nothing can be reused
+            Rectangle rootRegion(0, 0, statistics.getWidth() - 1, statistics.getHeight() - 1);
+            imageWidth_ = statistics.getWidth();
+            imageHeight_ = statistics.getHeight();
+            rootNode_ = buildTreeRecursive(statistics, rootRegion);
+        } else if (!changedRegions.empty()) {
+            rebuildNodeRecursive(statistics, rootNode_, changedRegions);
+        }
+        
+        mergedRegionCount_ = 0;
+    }
+
+    void AdaptiveImageTree::rebuildNodeRecursive(const ImageStatistics& statistics,
+                                                 std::unique_ptr<TreeNode>& node,
+                                                 const std::vector<Rectangle>& changedRegions) {
+        if (!node) return;
+        
+        // Branches that don't touch a changed area come out exactly the same, so keep them
+        bool touched = std::any_of(changedRegions.begin(), changedRegions.end(),
+                                   [&](const Rectangle& changed) { return node->region.intersects(changed); });
+        if (!touched) return;
+        
+        const Rectangle& region = node->region;
+        
+        // Same stopping rules as buildTreeRecursive
+        if (region.upperLeft == region.lowerRight || statistics.isFullyTransparent(region) ||
+            statistics.calculateEntropy(region) < 0.1) {
+            node->leftChild.reset();
+            node->rightChild.reset();
+            node->colorSums = statistics.getColorSums(region);
+            return;
+        }
+        
+        auto splitResult = findOptimalSplit(statistics, region);
+        
+        // If the region still splits the same way, only the changed children need work
+        if (node->leftChild && node->rightChild &&
+            node->leftChild->region == splitResult.first &&
+            node->rightChild->region == splitResult.second) {
+            rebuildNodeRecursive(statistics, node->leftChild, changedRegions);
+            rebuildNodeRecursive(statistics, node->rightChild, changedRegions);
+        } else {
+            node->leftChild = buildTreeRecursive(statistics, splitResult.first);
+            node->rightChild = buildTreeRecursive(statistics, splitResult.second);
+        }
+        
+        node->colorSums = node->leftChild->colorSums;
+        node->colorSums += node->rightChild->colorSums;
+    }
+
     std::pair<Rectangle, Rectangle> 
     AdaptiveImageTree::findOptimalSplit(const ImageStatistics& statistics, 
                                        const Rectangle& region) {
@@ -80,26 +355,36 @@ namespace ImageCompression {
         
         // Smart sampling: only test a subset of split positions for large regions
         // This reduces complexity from O(width+height) to O(log(width+height))
-        auto getSplitCandidates = [](int start, int end, int maxCandidates = 8) {
-            std::vector<int> candidates;
-            if (end - start <= maxCandidates) {
+        // Candidates go in a fixed array - there are never more than MAX_SPLIT_CANDIDATES
+        struct SplitCandidates {
+            int positions[MAX_SPLIT_CANDIDATES];
+            int count = 0;
+            
+            void add(int position) { positions[count++] = position; }
+            const int* begin() const { return positions; }
+            const int* end() const { return positions + count; }
+        };
+        
+        auto getSplitCandidates = [](int start, int end) {
+            SplitCandidates candidates;
+            if (end - start <= MAX_SPLIT_CANDIDATES) {
                 // Small region: test all positions
                 for (int i = start; i < end; ++i) {
-                    candidates.push_back(i);
+                    candidates.add(i);
                 }
             } else {
                 // Large region: sample key positions
-                candidates.push_back(start + (end - start) / 4);     // 25%
-                candidates.push_back(start + (end - start) / 3);     // 33%
-                candidates.push_back(start + (end - start) / 2);     // 50%
-                candidates.push_back(start + 2 * (end - start) / 3); // 67%
-                candidates.push_back(start + 3 * (end - start) / 4); // 75%
+                candidates.add(start + (end - start) / 4);     // 25%
+                candidates.add(start + (end - start) / 3);     // 33%
+                candidates.add(start + (end - start) / 2);     // 50%
+                candidates.add(start + 2 * (end - start) / 3); // 67%
+                candidates.add(start + 3 * (end - start) / 4); // 75%
                 
                 // Add a few random positions for variety
                 int step = std::max(1, (end - start) / 10);
                 for (int i = start + step; i < end; i += step) {
-                    if (candidates.size() < maxCandidates) {
-                        candidates.push_back(i);
+                    if (candidates.count < MAX_SPLIT_CANDIDATES) {
+                        candidates.add(i);
                     }
                 }
             }
@@ -162,32 +447,87 @@ namespace ImageCompression {
     Utils::PNG AdaptiveImageTree::renderToImage() const {
         Utils::PNG outputImage(imageWidth_, imageHeight_);
         
+        // Take the pixels once up front - the parallel walk below only writes through the pointer
         if (rootNode_) {
-            renderNodeRecursive(outputImage, rootNode_.get());
+            renderNodeRecursive(outputImage.getPixelData(), rootNode_.get());
         }
         
         return outputImage;
     }
 
-    void AdaptiveImageTree::renderNodeRecursive(Utils::PNG& outputImage, 
+    void AdaptiveImageTree::renderToBuffer(const Utils::MutableImageView& output) const {
+        if (static_cast<int>(output.width) != imageWidth_ || static_cast<int>(output.height) != imageHeight_) {
+            throw std::runtime_error("Output buffer is " + std::to_string(output.width) + "x" +
+                                     std::to_string(output.height) + ", image is " +
+                                     std::to_string(imageWidth_) + "x" + std::to_string(imageHeight_));
+        }
+        
+        if (rootNode_) {
+            renderNodeToBuffer(output, rootNode_.get());
+        }
+    }
+
+    void AdaptiveImageTree::renderNodeToBuffer(const Utils::MutableImageView& output,
                                                const TreeNode* node) const {
         if (!node) return;
         
-        // If this region didn't get split further, just fill it with one color
+        // Regions never overlap, so big halves can be filled on separate threads
+        if (node->leftChild || node->rightChild) {
+            if (getRegionArea(node->region) >= PARALLEL_MIN_PIXELS) {
+                Utils::parallelInvoke([&]() { renderNodeToBuffer(output, node->leftChild.get()); },
+                                      [&]() { renderNodeToBuffer(output, node->rightChild.get()); });
+            } else {
+                renderNodeToBuffer(output, node->leftChild.get());
+                renderNodeToBuffer(output, node->rightChild.get());
+            }
+            return;
+        }
+        
+        // Convert the region's color to bytes once
+        Utils::HSLAPixel color = getNodeColor(node);
+        Utils::RGBColor rgb = Utils::hslaToRgb(Utils::HSLAColor(color.hue, color.saturation,
+                                                                color.luminance, color.alpha));
+        uint8_t packed[4];
+        output.packPixel(rgb, packed);
+        size_t pixelBytes = Utils::bytesPerPixel(output.format);
+        
+        // Fill the first row, then copy it down the rest
+        const Rectangle& region = node->region;
+        size_t rowBytes = static_cast<size_t>(region.lowerRight.first - region.upperLeft.first + 1) * pixelBytes;
+        uint8_t* firstRow = output.data + static_cast<size_t>(region.upperLeft.second) * output.stride +
+                            static_cast<size_t>(region.upperLeft.first) * pixelBytes;
+        for (size_t offset = 0; offset < rowBytes; offset += pixelBytes) {
+            std::memcpy(firstRow + offset, packed, pixelBytes);
+        }
+        for (int y = region.upperLeft.second + 1; y <= region.lowerRight.second; ++y) {
+            std::memcpy(firstRow + static_cast<size_t>(y - region.upperLeft.second) * output.stride,
+                        firstRow, rowBytes);
+        }
+    }
+
+    void AdaptiveImageTree::renderNodeRecursive(Utils::HSLAPixel* pixels, 
+                                               const TreeNode* node) const {
+        if (!node) return;
+        
+        // If this region didn't get split further, just fill it with one color, a row at a time
         if (!node->leftChild && !node->rightChild) {
-            for (int x = node->region.upperLeft.first; x <= node->region.lowerRight.first; ++x) {
-                for (int y = node->region.upperLeft.second; y <= node->region.lowerRight.second; ++y) {
-                    Utils::HSLAPixel* pixel = outputImage.getPixel(x, y);
-                    *pixel = node->averageColor;
-                }
+            Utils::HSLAPixel color = getNodeColor(node);
+            const Rectangle& region = node->region;
+            for (int y = region.upperLeft.second; y <= region.lowerRight.second; ++y) {
+                Utils::HSLAPixel* row = pixels + static_cast<size_t>(y) * imageWidth_;
+                std::fill(row + region.upperLeft.first, row + region.lowerRight.first + 1, color);
             }
+        } else if (getRegionArea(node->region) >= PARALLEL_MIN_PIXELS) {
+            // This region got split, so render both halves - big ones on separate threads
+            Utils::parallelInvoke([&]() { renderNodeRecursive(pixels, node->leftChild.get()); },
+                                  [&]() { renderNodeRecursive(pixels, node->rightChild.get()); });
         } else {
             // This region got split, so render both halves
             if (node->leftChild) {
-                renderNodeRecursive(outputImage, node->leftChild.get());
+                renderNodeRecursive(pixels, node->leftChild.get());
             }
             if (node->rightChild) {
-                renderNodeRecursive(outputImage, node->rightChild.get());
+                renderNodeRecursive(pixels, node->rightChild.get());
             }
         }
     }
@@ -196,7 +536,7 @@ namespace ImageCompression {
     AdaptiveImageTree::copyTreeRecursive(const TreeNode* sourceNode) {
         if (!sourceNode) return nullptr;
         
-        auto newNode = std::make_unique<TreeNode>(sourceNode->region, sourceNode->averageColor);
+        auto newNode = std::make_unique<TreeNode>(sourceNode->region, sourceNode->colorSums);
         
         if (sourceNode->leftChild) {
             newNode->leftChild = copyTreeRecursive(sourceNode->leftChild.get());
@@ -229,58 +569,339 @@ namespace ImageCompression {
                countLeafNodesRecursive(node->rightChild.get());
     }
 
+    size_t AdaptiveImageTree::countRegions() const {
+        // Once neighbours are merged several leaves share one region
+        return mergedRegionCount_ > 0 ? mergedRegionCount_ : countLeafNodes();
+    }
+
+    void AdaptiveImageTree::collectLeafNodes(TreeNode* node, std::vector<TreeNode*>& leaves) {
+        if (!node) return;
+        
+        if (!node->leftChild && !node->rightChild) {
+            leaves.push_back(node);
+            return;
+        }
+        
+        collectLeafNodes(node->leftChild.get(), leaves);
+        collectLeafNodes(node->rightChild.get(), leaves);
+    }
+
+    bool AdaptiveImageTree::budgetExhausted() const {
+        return budgetExhausted_;
+    }
+
+    double AdaptiveImageTree::squaredError(const SquaredErrorTable& errors) const {
+        return rootNode_ ? squaredErrorRecursive(rootNode_.get(), errors) : 0.0;
+    }
+
+    double AdaptiveImageTree::squaredErrorRecursive(const TreeNode* node, const SquaredErrorTable& errors) const {
+        if (node->leftChild || node->rightChild) {
+            return (node->leftChild ? squaredErrorRecursive(node->leftChild.get(), errors) : 0.0) +
+                   (node->rightChild ? squaredErrorRecursive(node->rightChild.get(), errors) : 0.0);
+        }
+        
+        // The same bytes the renderer would write
+        Utils::HSLAPixel color = getNodeColor(node);
+        Utils::RGBColor rgb = Utils::hslaToRgb(Utils::HSLAColor(color.hue, color.saturation,
+                                                                color.luminance, color.alpha));
+        return errors.squaredError(node->region, rgb);
+    }
+
+    RegionSummary AdaptiveImageTree::summarizeRegions() const {
+        RegionSummary summary;
+        summary.regions = countRegions();
+        
+        std::vector<TreeNode*> leaves;
+        collectLeafNodes(rootNode_.get(), leaves);
+        
+        // Colors as the encoder will see them, packed so duplicates sort next to each other
+        std::vector<uint32_t> colors;
+        colors.reserve(leaves.size());
+        for (const TreeNode* leaf : leaves) {
+            Utils::HSLAPixel color = getNodeColor(leaf);
+            Utils::RGBColor rgb = Utils::hslaToRgb(Utils::HSLAColor(color.hue, color.saturation,
+                                                                    color.luminance, color.alpha));
+            colors.push_back((static_cast<uint32_t>(rgb.red) << 24) | (static_cast<uint32_t>(rgb.green) << 16) |
+                             (static_cast<uint32_t>(rgb.blue) << 8) | rgb.alpha);
+            
+            const Rectangle& region = leaf->region;
+            summary.edgeLength += static_cast<size_t>(region.lowerRight.first - region.upperLeft.first + 1) +
+                                  static_cast<size_t>(region.lowerRight.second - region.upperLeft.second + 1);
+        }
+        std::sort(colors.begin(), colors.end());
+        summary.colors = static_cast<size_t>(std::unique(colors.begin(), colors.end()) - colors.begin());
+        
+        return summary;
+    }
+
     double AdaptiveImageTree::getCompressionRatio() const {
         size_t totalPixels = static_cast<size_t>(imageWidth_) * imageHeight_;
-        size_t leafNodes = countLeafNodes();
+        size_t regions = countRegions();
         
         if (totalPixels == 0) return 0.0;
         
         // How many regions we ended up with compared to original pixels
         // Smaller number = more compression (fewer regions = more simplified)
-        return static_cast<double>(leafNodes) / totalPixels;
+        return static_cast<double>(regions) / totalPixels;
     }
 
     void AdaptiveImageTree::pruneTree(const PruningConfig& config) {
         if (rootNode_) {
-            pruneNodeRecursive(rootNode_, config);
+            std::vector<LeafSample> leafSamples;
+            pruneNodeRecursive(rootNode_, config, leafSamples);
         }
+        
+        // The leaf layout changed, so any earlier merge no longer describes it
+        mergedRegionCount_ = 0;
+    }
+
+    namespace {
+        // Two leaves that touch along an edge, and how different their colors are
+        struct LeafAdjacency {
+            double colorDistance;
+            int first;
+            int second;
+            
+            bool operator>(const LeafAdjacency& other) const {
+                return colorDistance > other.colorDistance;
+            }
+        };
+        
+        // One side of a leaf rectangle: the line it sits on and the span it covers
+        struct LeafEdge {
+            int line;
+            int spanStart;
+            int spanEnd;
+            int leaf;
+            
+            bool operator<(const LeafEdge& other) const {
+                if (line != other.line) return line < other.line;
+                return spanStart < other.spanStart;
+            }
+        };
+        
+        // A group of merged leaves - color totals of what gets painted, plus the bounding box of member colors
+        // Colors live in (chroma x, chroma y, luminance, alpha) so greys with random hues still match
+        struct MergedRegion {
+            double area;
+            ColorSums sums;
+            double minChromaX, maxChromaX;
+            double minChromaY, maxChromaY;
+            double minLuminance, maxLuminance;
+            double minAlpha, maxAlpha;
+        };
+        
+        MergedRegion makeMergedRegion(const ColorSums& leafSums, double area) {
+            // Fully transparent leaves have no color to speak of - they only match each other
+            if (leafSums.isFullyTransparent()) {
+                return MergedRegion{area, leafSums, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+            }
+            
+            // A leaf is painted with its average hue at its average saturation,
+            // so point the summed hue direction at that saturation - no trig needed
+            // (the color sums are alpha-weighted, so averages divide by total alpha)
+            double saturation = leafSums.saturation / leafSums.alpha;
+            double hueLength = std::hypot(leafSums.hueX, leafSums.hueY);
+            double chromaX = hueLength > 0.0 ? saturation * leafSums.hueX / hueLength : saturation;
+            double chromaY = hueLength > 0.0 ? saturation * leafSums.hueY / hueLength : 0.0;
+            double luminance = leafSums.luminance / leafSums.alpha;
+            double alpha = leafSums.alpha / area;
+            
+            ColorSums painted = leafSums;
+            painted.hueX = chromaX * leafSums.alpha;
+            painted.hueY = chromaY * leafSums.alpha;
+            
+            return MergedRegion{area, painted,
+                                chromaX, chromaX, chromaY, chromaY,
+                                luminance, luminance, alpha, alpha};
+        }
+        
+        MergedRegion combineRegions(const MergedRegion& a, const MergedRegion& b) {
+            ColorSums sums = a.sums;
+            sums += b.sums;
+            return MergedRegion{a.area + b.area, sums,
+                                std::min(a.minChromaX, b.minChromaX), std::max(a.maxChromaX, b.maxChromaX),
+                                std::min(a.minChromaY, b.minChromaY), std::max(a.maxChromaY, b.maxChromaY),
+                                std::min(a.minLuminance, b.minLuminance), std::max(a.maxLuminance, b.maxLuminance),
+                                std::min(a.minAlpha, b.minAlpha), std::max(a.maxAlpha, b.maxAlpha)};
+        }
+        
+        // Widest color difference inside the group - caps how far a chain of merges can drift
+        // Hue only counts as much as the saturation behind it, so this isn't calculateColorDistance
+        double colorSpread(const MergedRegion& region) {
+            double dx = region.maxChromaX - region.minChromaX;
+            double dy = region.maxChromaY - region.minChromaY;
+            double dl = region.maxLuminance - region.minLuminance;
+            double da = region.maxAlpha - region.minAlpha;
+            return std::sqrt(dx * dx + dy * dy + dl * dl + da * da);
+        }
+        
+        int findRoot(std::vector<int>& parents, int index) {
+            while (parents[index] != index) {
+                parents[index] = parents[parents[index]];  // Path halving keeps the trees flat
+                index = parents[index];
+            }
+            return index;
+        }
+        
+        // Walk two sorted edge lists and report every pair that shares a line and overlapping span
+        template <typename Visitor>
+        void forEachTouchingPair(const std::vector<LeafEdge>& closing,
+                                 const std::vector<LeafEdge>& opening,
+                                 Visitor visit) {
+            size_t i = 0, j = 0;
+            while (i < closing.size() && j < opening.size()) {
+                const LeafEdge& a = closing[i];
+                const LeafEdge& b = opening[j];
+                
+                if (a.line != b.line) {
+                    if (a.line < b.line) ++i; else ++j;
+                    continue;
+                }
+                
+                if (a.spanStart <= b.spanEnd && b.spanStart <= a.spanEnd) {
+                    visit(a.leaf, b.leaf);
+                }
+                
+                // Move past whichever span finishes first
+                if (a.spanEnd < b.spanEnd) ++i; else ++j;
+            }
+        }
+    }
+
+    void AdaptiveImageTree::mergeAdjacentRegions(const PruningConfig& config) {
+        std::vector<TreeNode*> leaves;
+        collectLeafNodes(rootNode_.get(), leaves);
+        if (leaves.size() < 2) return;
+        
+        int leafCount = static_cast<int>(leaves.size());
+        std::vector<MergedRegion> regions;
+        regions.reserve(leafCount);
+        for (const TreeNode* leaf : leaves) {
+            regions.push_back(makeMergedRegion(leaf->colorSums, static_cast<double>(getRegionArea(leaf->region))));
+        }
+        
+        // Leaves tile the image, so neighbours are found by matching the edges they share
+        // Sorting the edges keeps this O(L log L) instead of scanning pixels
+        std::vector<LeafEdge> rightSides, leftSides, bottomSides, topSides;
+        rightSides.reserve(leafCount);
+        leftSides.reserve(leafCount);
+        bottomSides.reserve(leafCount);
+        topSides.reserve(leafCount);
+        for (int i = 0; i < leafCount; ++i) {
+            const Rectangle& r = leaves[i]->region;
+            rightSides.push_back({r.lowerRight.first + 1, r.upperLeft.second, r.lowerRight.second, i});
+            leftSides.push_back({r.upperLeft.first, r.upperLeft.second, r.lowerRight.second, i});
+            bottomSides.push_back({r.lowerRight.second + 1, r.upperLeft.first, r.lowerRight.first, i});
+            topSides.push_back({r.upperLeft.second, r.upperLeft.first, r.lowerRight.first, i});
+        }
+        std::sort(rightSides.begin(), rightSides.end());
+        std::sort(leftSides.begin(), leftSides.end());
+        std::sort(bottomSides.begin(), bottomSides.end());
+        std::sort(topSides.begin(), topSides.end());
+        
+        // Only neighbours that could ever merge go in the queue, cheapest first
+        std::vector<LeafAdjacency> candidates;
+        auto addCandidate = [&](int a, int b) {
+            MergedRegion combined = combineRegions(regions[a], regions[b]);
+            double spread = colorSpread(combined);
+            if (spread <= config.mergeColorTolerance) {
+                candidates.push_back({spread, a, b});
+            }
+        };
+        forEachTouchingPair(rightSides, leftSides, addCandidate);
+        forEachTouchingPair(bottomSides, topSides, addCandidate);
+        
+        std::priority_queue<LeafAdjacency, std::vector<LeafAdjacency>,
+                            std::greater<LeafAdjacency>> mergeQueue(std::greater<LeafAdjacency>(),
+                                                                    std::move(candidates));
+        
+        std::vector<int> parents(leafCount);
+        std::iota(parents.begin(), parents.end(), 0);
+        size_t remainingRegions = leaves.size();
+        
+        while (!mergeQueue.empty()) {
+            LeafAdjacency next = mergeQueue.top();
+            mergeQueue.pop();
+            
+            int rootA = findRoot(parents, next.first);
+            int rootB = findRoot(parents, next.second);
+            if (rootA == rootB) continue;
+            
+            // Groups have grown since this pair was queued, so check the combined spread again
+            MergedRegion combined = combineRegions(regions[rootA], regions[rootB]);
+            if (colorSpread(combined) > config.mergeColorTolerance) continue;
+            
+            // Hang the smaller group under the larger one
+            if (regions[rootA].area < regions[rootB].area) std::swap(rootA, rootB);
+            parents[rootB] = rootA;
+            regions[rootA] = combined;
+            --remainingRegions;
+        }
+        
+        // Every leaf in a group gets painted with the group's color - its share of the group's totals
+        std::vector<int> groupSizes(leafCount, 0);
+        for (int i = 0; i < leafCount; ++i) {
+            groupSizes[findRoot(parents, i)]++;
+        }
+        for (int i = 0; i < leafCount; ++i) {
+            int root = findRoot(parents, i);
+            if (groupSizes[root] > 1) {
+                leaves[i]->colorSums = regions[root].sums * (getRegionArea(leaves[i]->region) / regions[root].area);
+            }
+        }
+        
+        mergedRegionCount_ = remainingRegions;
     }
 
     void AdaptiveImageTree::pruneNodeRecursive(std::unique_ptr<TreeNode>& node, 
-                                              const PruningConfig& config) {
+                                              const PruningConfig& config,
+                                              std::vector<LeafSample>& leafSamples) {
         if (!node) return;
         
-        // If this region is already unsplit, nothing to do
+        // If this region is already unsplit, nothing to prune - just note its color
         if (!node->leftChild && !node->rightChild) {
+            leafSamples.push_back({getNodeColor(node.get()), getRegionArea(node->region)});
             return;
         }
         
         // First, prune the child branches
+        size_t firstLeaf = leafSamples.size();
         if (node->leftChild) {
-            pruneNodeRecursive(node->leftChild, config);
+            pruneNodeRecursive(node->leftChild, config, leafSamples);
         }
         if (node->rightChild) {
-            pruneNodeRecursive(node->rightChild, config);
+            pruneNodeRecursive(node->rightChild, config, leafSamples);
         }
         
         // Now check if we can merge this whole branch into one region
-        if (shouldPruneSubtree(node.get(), config)) {
+        Utils::HSLAPixel branchColor = getNodeColor(node.get());
+        if (shouldPruneSubtree(branchColor, leafSamples.data() + firstLeaf,
+                               leafSamples.data() + leafSamples.size(), config)) {
             // Throw away the children - this becomes a single region
             node->leftChild.reset();
             node->rightChild.reset();
+            
+            leafSamples.resize(firstLeaf);
+            leafSamples.push_back({branchColor, getRegionArea(node->region)});
         }
     }
 
-    bool AdaptiveImageTree::shouldPruneSubtree(const TreeNode* node, 
+    bool AdaptiveImageTree::shouldPruneSubtree(const Utils::HSLAPixel& branchColor,
+                                              const LeafSample* firstLeaf,
+                                              const LeafSample* lastLeaf,
                                               const PruningConfig& config) const {
-        if (!node || (!node->leftChild && !node->rightChild)) {
-            return false; // Nothing to prune here
-        }
-        
         // Count how many pixels in this branch are similar to the average color
-        int totalPixels = 0;
-        int similarPixels = countSimilarPixels(node, node->averageColor, 
-                                             config.colorToleranceThreshold, totalPixels);
+        long totalPixels = 0;
+        long similarPixels = 0;
+        for (const LeafSample* leaf = firstLeaf; leaf != lastLeaf; ++leaf) {
+            totalPixels += leaf->area;
+            
+            // A leaf's pixels count as similar all together or not at all
+            if (calculateColorDistance(leaf->color, branchColor) <= config.colorToleranceThreshold) {
+                similarPixels += leaf->area;
+            }
+        }
         
         if (totalPixels == 0) return false;
         
@@ -289,40 +910,13 @@ namespace ImageCompression {
         return similarityPercentage >= config.minimumSimilarityPercentage;
     }
 
-    int AdaptiveImageTree::countSimilarPixels(const TreeNode* node, 
-                                            const Utils::HSLAPixel& referenceColor,
-                                            double tolerance, 
-                                            int& totalPixels) const {
-        if (!node) {
-            return 0;
-        }
-        
-        // If this region is unsplit, check if its color is close enough
-        if (!node->leftChild && !node->rightChild) {
-            int regionArea = (node->region.lowerRight.first - node->region.upperLeft.first + 1) *
-                           (node->region.lowerRight.second - node->region.upperLeft.second + 1);
-            totalPixels += regionArea;
-            
-            double colorDistance = calculateColorDistance(node->averageColor, referenceColor);
-            if (colorDistance <= tolerance) {
-                return regionArea;  // All pixels in this region count as similar
-            } else {
-                return 0;  // None of them are similar enough
-            }
-        }
-        
-        // For split regions, check both halves
-        int similarCount = 0;
-        if (node->leftChild) {
-            similarCount += countSimilarPixels(node->leftChild.get(), referenceColor, 
-                                             tolerance, totalPixels);
-        }
-        if (node->rightChild) {
-            similarCount += countSimilarPixels(node->rightChild.get(), referenceColor, 
-                                             tolerance, totalPixels);
-        }
-        
-        return similarCount;
+    Utils::HSLAPixel AdaptiveImageTree::getNodeColor(const TreeNode* node) const {
+        return ImageStatistics::averageFromSums(node->colorSums, getRegionArea(node->region));
+    }
+
+    long AdaptiveImageTree::getRegionArea(const Rectangle& region) {
+        return static_cast<long>(region.lowerRight.first - region.upperLeft.first + 1) *
+               (region.lowerRight.second - region.upperLeft.second + 1);
     }
 
     double AdaptiveImageTree::calculateColorDistance(const Utils::HSLAPixel& color1,
@@ -338,9 +932,10 @@ namespace ImageCompression {
         
         double satDiff = color1.saturation - color2.saturation;
         double lumDiff = color1.luminance - color2.luminance;
+        double alphaDiff = color1.alpha - color2.alpha; // See-through vs solid is a big difference too
         
-        // Good old Pythagorean theorem in 3D color space
-        return std::sqrt(hueDiff * hueDiff + satDiff * satDiff + lumDiff * lumDiff);
+        // Good old Pythagorean theorem in 4D color space
+        return std::sqrt(hueDiff * hueDiff + satDiff * satDiff + lumDiff * lumDiff + alphaDiff * alphaDiff);
     }
 
 } // namespace ImageCompression 
\ No newline at end of file
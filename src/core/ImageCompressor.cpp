@@ -1,7 +1,15 @@
 #include "../../include/core/ImageCompressor.h"
+#include "../../include/cache/ResultCache.h"
+#include "../../include/statistics/SquaredErrorTable.h"
+#include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
 #include <stdexcept>
 
 namespace ImageCompression {
@@ -23,42 +31,189 @@ namespace ImageCompression {
         return performCompression(inputImage, config);
     }
 
+    CompressionResult ImageCompressor::compressImage(const Utils::PNG& inputImage,
+                                                   const PruningConfig& config,
+                                                   const BuildConfig& buildConfig) {
+        return performCompression(inputImage, config, buildConfig);
+    }
+
     CompressionResult ImageCompressor::compressImageFile(const std::string& inputFilePath,
                                                        const std::string& outputFilePath,
                                                        double qualityScore) {
+        Utils::MemoryUsageScope memoryScope;
+        
         // Load input image
+        StageProbe decodeProbe;
         Utils::PNG inputImage;
         if (!inputImage.loadFromFile(inputFilePath)) {
             throw std::runtime_error("Failed to load image from: " + inputFilePath);
         }
+        StageMeasurement decodeStage = decodeProbe.finish();
         
         // Perform compression
         CompressionResult result = compressImage(inputImage, qualityScore);
+        result.stageMetrics[PipelineStage::Decode] = decodeStage;
         
         // Save compressed image
+        StageProbe encodeProbe;
         if (!result.compressedImage.saveToFile(outputFilePath)) {
             throw std::runtime_error("Failed to save compressed image to: " + outputFilePath);
         }
+        result.stageMetrics[PipelineStage::Encode] = encodeProbe.finish();
         
+        result.memoryUsage = memoryScope.usage();
         return result;
     }
 
     CompressionResult ImageCompressor::compressImageFile(const std::string& inputFilePath,
                                                        const std::string& outputFilePath,
                                                        CompressionQuality quality) {
+        Utils::MemoryUsageScope memoryScope;
+        
         // Load input image
+        StageProbe decodeProbe;
         Utils::PNG inputImage;
         if (!inputImage.loadFromFile(inputFilePath)) {
             throw std::runtime_error("Failed to load image from: " + inputFilePath);
         }
+        StageMeasurement decodeStage = decodeProbe.finish();
         
         // Perform compression
         CompressionResult result = compressImage(inputImage, quality);
+        result.stageMetrics[PipelineStage::Decode] = decodeStage;
         
         // Save compressed image
+        StageProbe encodeProbe;
+        if (!result.compressedImage.saveToFile(outputFilePath)) {
+            throw std::runtime_error("Failed to save compressed image to: " + outputFilePath);
+        }
+        result.stageMetrics[PipelineStage::Encode] = encodeProbe.finish();
+        
+        result.memoryUsage = memoryScope.usage();
+        return result;
+    }
+
+    CompressionResult ImageCompressor::compressBuffer(const uint8_t* data, size_t size,
+                                                    std::vector<uint8_t>& out,
+                                                    double qualityScore) {
+        return compressBuffer(data, size, out, getConfigForQuality(qualityScore));
+    }
+
+    CompressionResult ImageCompressor::compressImageFile(const std::string& inputFilePath,
+                                                       const std::string& outputFilePath,
+                                                       const PruningConfig& config,
+                                                       const BuildConfig& buildConfig) {
+        Utils::MemoryUsageScope memoryScope;
+        
+        StageProbe decodeProbe;
+        Utils::PNG inputImage;
+        if (!inputImage.loadFromFile(inputFilePath)) {
+            throw std::runtime_error("Failed to load image from: " + inputFilePath);
+        }
+        StageMeasurement decodeStage = decodeProbe.finish();
+        
+        CompressionResult result = performCompression(inputImage, config, buildConfig);
+        result.stageMetrics[PipelineStage::Decode] = decodeStage;
+        
+        StageProbe encodeProbe;
         if (!result.compressedImage.saveToFile(outputFilePath)) {
             throw std::runtime_error("Failed to save compressed image to: " + outputFilePath);
         }
+        result.stageMetrics[PipelineStage::Encode] = encodeProbe.finish();
+        
+        result.memoryUsage = memoryScope.usage();
+        return result;
+    }
+
+    CompressionResult ImageCompressor::compressBuffer(const uint8_t* data, size_t size,
+                                                    std::vector<uint8_t>& out,
+                                                    const PruningConfig& config) {
+        return compressBuffer(data, size, out, config, BuildConfig());
+    }
+
+    CompressionResult ImageCompressor::compressBuffer(const uint8_t* data, size_t size,
+                                                    std::vector<uint8_t>& out,
+                                                    const PruningConfig& config,
+                                                    const BuildConfig& buildConfig) {
+        Utils::MemoryUsageScope memoryScope;
+        
+        // Decode straight from the caller's bytes
+        StageProbe decodeProbe;
+        Utils::PNG inputImage;
+        inputImage.loadFromMemory(data, size);
+        StageMeasurement decodeStage = decodeProbe.finish();
+        
+        CompressionResult result = performCompression(inputImage, config, buildConfig);
+        result.stageMetrics[PipelineStage::Decode] = decodeStage;
+        
+        // Encode into the caller's vector
+        StageProbe encodeProbe;
+        result.compressedImage.saveToMemory(out);
+        result.stageMetrics[PipelineStage::Encode] = encodeProbe.finish();
+        result.encodedBytes = out.size();
+        
+        result.memoryUsage = memoryScope.usage();
+        return result;
+    }
+
+    CompressionResult ImageCompressor::compressBuffer(const uint8_t* data, size_t size,
+                                                    std::vector<uint8_t>& out,
+                                                    const PruningConfig& config,
+                                                    ResultCache& cache) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Utils::MemoryUsageScope memoryScope;
+        
+        // The key is over the raw PNG bytes, so a hit never needs to decode them
+        std::string key = ResultCache::makeKey(data, size, config);
+        CachedResultInfo info;
+        
+        bool hit = cache.lookup(key, out, info);
+        CompressionResult result(Utils::PNG(), info.compressionRatio, info.originalPixels,
+                                 info.compressedRegions, 0.0);
+        if (!hit) {
+            result = compressBuffer(data, size, out, config);
+            
+            info.compressionRatio = result.compressionRatio;
+            info.originalPixels = result.originalPixels;
+            info.compressedRegions = result.compressedRegions;
+            info.processingTimeSeconds = result.processingTimeSeconds;
+            cache.store(key, out, info);
+        }
+        result.memoryUsage = memoryScope.usage();
+        
+        if (hit) {
+            result.servedFromCache = true;
+            result.encodedBytes = out.size();
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::high_resolution_clock::now() - startTime);
+            result.processingTimeSeconds = duration.count() / 1000.0;
+        }
+        
+        return result;
+    }
+
+    CompressionResult ImageCompressor::compressImageFile(const std::string& inputFilePath,
+                                                       const std::string& outputFilePath,
+                                                       const PruningConfig& config,
+                                                       ResultCache& cache) {
+        // The key is over the raw file bytes, so a hit never needs to decode the PNG
+        std::ifstream inputFile(inputFilePath, std::ios::binary);
+        if (!inputFile) {
+            throw std::runtime_error("Failed to load image from: " + inputFilePath);
+        }
+        std::vector<uint8_t> inputBytes((std::istreambuf_iterator<char>(inputFile)),
+                                        std::istreambuf_iterator<char>());
+        
+        std::vector<uint8_t> outputBytes;
+        CompressionResult result = compressBuffer(inputBytes.data(), inputBytes.size(), outputBytes,
+                                                  config, cache);
+        
+        std::ofstream outputFile(outputFilePath, std::ios::binary | std::ios::trunc);
+        outputFile.write(reinterpret_cast<const char*>(outputBytes.data()),
+                         static_cast<std::streamsize>(outputBytes.size()));
+        if (!outputFile) {
+            throw std::runtime_error("Failed to save compressed image to: " + outputFilePath);
+        }
         
         return result;
     }
@@ -156,32 +311,332 @@ namespace ImageCompression {
         }
     }
 
-    CompressionResult ImageCompressor::performCompression(const Utils::PNG& inputImage,
+    const char* pipelineStageName(PipelineStage stage) {
+        switch (stage) {
+            case PipelineStage::Decode:     return "decode";
+            case PipelineStage::Statistics: return "statistics";
+            case PipelineStage::TreeBuild:  return "tree-build";
+            case PipelineStage::Prune:      return "prune";
+            case PipelineStage::Render:     return "render";
+            case PipelineStage::Encode:     return "encode";
+        }
+        return "unknown";
+    }
+
+    CompressionResult ImageCompressor::compressTree(const AdaptiveImageTree& tree,
+                                                  const PruningConfig& config) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Utils::MemoryUsageScope memoryScope;
+        
+        // Work on a copy so the caller's tree keeps all its detail
+        StageProbe copyProbe;
+        AdaptiveImageTree prunedTree(tree);
+        StageMeasurement copyStage = copyProbe.finish();
+        
+        CompressionResult result = finishCompression(prunedTree, config, startTime);
+        result.stageMetrics[PipelineStage::TreeBuild] = copyStage;
+        return result;
+    }
+
+    CompressionResult ImageCompressor::compressPixels(const Utils::ImageView& input,
+                                                    const Utils::MutableImageView& output,
+                                                    double qualityScore) {
+        return compressPixels(input, output, getConfigForQuality(qualityScore));
+    }
+
+    CompressionResult ImageCompressor::compressPixels(const Utils::ImageView& input,
+                                                    const Utils::MutableImageView& output,
+                                                    const PruningConfig& config) {
+        if (output.width != input.width || output.height != input.height) {
+            throw std::runtime_error("Output buffer must be the same size as the input");
+        }
+        
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Utils::MemoryUsageScope memoryScope;
+        
+        // Statistics read the caller's pixels directly
+        StageProbe statisticsProbe;
+        ImageStatistics statistics(input);
+        StageMeasurement statisticsStage = statisticsProbe.finish();
+        
+        StageProbe buildProbe;
+        AdaptiveImageTree tree(statistics);
+        StageMeasurement buildStage = buildProbe.finish();
+        
+        CompressionResult result = finishCompression(tree, config, startTime, &output);
+        result.stageMetrics[PipelineStage::Statistics] = statisticsStage;
+        result.stageMetrics[PipelineStage::TreeBuild] = buildStage;
+        return result;
+    }
+
+    CompressionResult ImageCompressor::compressStatistics(const ImageStatistics& statistics,
                                                         const PruningConfig& config) {
         auto startTime = std::chrono::high_resolution_clock::now();
+        Utils::MemoryUsageScope memoryScope;
+        
+        StageProbe buildProbe;
+        AdaptiveImageTree tree(statistics);
+        StageMeasurement buildStage = buildProbe.finish();
+        
+        CompressionResult result = finishCompression(tree, config, startTime);
+        result.stageMetrics[PipelineStage::TreeBuild] = buildStage;
+        return result;
+    }
+
+    CompressionResult ImageCompressor::compressStatistics(const ImageStatistics& statistics,
+                                                        const PruningConfig& config,
+                                                        const BuildConfig& buildConfig) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Utils::MemoryUsageScope memoryScope;
+        
+        StageProbe buildProbe;
+        AdaptiveImageTree tree(statistics, buildConfig);
+        StageMeasurement buildStage = buildProbe.finish();
+        
+        CompressionResult result = finishCompression(tree, config, startTime);
+        result.stageMetrics[PipelineStage::TreeBuild] = buildStage;
+        return result;
+    }
+
+    CompressionResult ImageCompressor::compressStatistics(const ImageStatistics& statistics,
+                                                        const PruningConfig& config,
+                                                        const Utils::MutableImageView& output) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Utils::MemoryUsageScope memoryScope;
+        
+        StageProbe buildProbe;
+        AdaptiveImageTree tree(statistics);
+        StageMeasurement buildStage = buildProbe.finish();
+        
+        CompressionResult result = finishCompression(tree, config, startTime, &output);
+        result.stageMetrics[PipelineStage::TreeBuild] = buildStage;
+        return result;
+    }
+
+    CompressionResult ImageCompressor::compressToQuality(const Utils::PNG& inputImage, double targetPsnr) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Utils::MemoryUsageScope memoryScope;
+        
+        // The error tables outlive the statistics - every probe is measured against them
+        StageProbe statisticsProbe;
+        auto statistics = std::make_unique<ImageStatistics>(inputImage);
+        SquaredErrorTable errors(inputImage);
+        StageMeasurement statisticsStage = statisticsProbe.finish();
+        
+        StageProbe buildProbe;
+        AdaptiveImageTree tree(*statistics);
+        StageMeasurement buildStage = buildProbe.finish();
+        statistics.reset();
+        
+        // Lower quality means a smaller output, so look for the lowest score that still
+        // meets the target. Every answer we settle on has actually been measured, so the
+        // target holds even where PSNR doesn't rise perfectly smoothly with quality
+        StageProbe searchProbe;
+        double chosenQuality = 1.0;
+        double chosenPsnr = measurePsnr(tree, getConfigForQuality(1.0), errors);
+        if (chosenPsnr >= targetPsnr) {
+            double lowestPsnr = measurePsnr(tree, getConfigForQuality(0.0), errors);
+            if (lowestPsnr >= targetPsnr) {
+                chosenQuality = 0.0;
+                chosenPsnr = lowestPsnr;
+            } else {
+                double failing = 0.0;
+                for (int step = 0; step < QUALITY_SEARCH_STEPS; ++step) {
+                    double middle = (failing + chosenQuality) / 2.0;
+                    double middlePsnr = measurePsnr(tree, getConfigForQuality(middle), errors);
+                    if (middlePsnr >= targetPsnr) {
+                        chosenQuality = middle;
+                        chosenPsnr = middlePsnr;
+                    } else {
+                        failing = middle;
+                    }
+                }
+            }
+        }
+        StageMeasurement searchStage = searchProbe.finish();
+        
+        CompressionResult result = finishCompression(tree, getConfigForQuality(chosenQuality), startTime);
+        result.qualityScore = chosenQuality;
+        result.psnr = chosenPsnr;
+        result.stageMetrics[PipelineStage::Statistics] = statisticsStage;
+        result.stageMetrics[PipelineStage::TreeBuild] = buildStage;
+        result.stageMetrics[PipelineStage::Prune] += searchStage;
+        return result;
+    }
+
+    CompressionResult ImageCompressor::compressToSize(const Utils::PNG& inputImage, size_t maxBytes,
+                                                    std::vector<uint8_t>& out) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Utils::MemoryUsageScope memoryScope;
+        
+        StageProbe statisticsProbe;
+        auto statistics = std::make_unique<ImageStatistics>(inputImage);
+        StageMeasurement statisticsStage = statisticsProbe.finish();
+        
+        StageProbe buildProbe;
+        AdaptiveImageTree tree(*statistics);
+        StageMeasurement buildStage = buildProbe.finish();
+        statistics.reset();
+        
+        // The search only ever tries the same few quality steps, so a retry mostly reuses
+        // estimates it already has
+        std::map<double, double> estimates;
+        auto estimateFor = [&](double quality) {
+            auto known = estimates.find(quality);
+            if (known != estimates.end()) return known->second;
+            double bytes = estimateEncodedBytes(tree, getConfigForQuality(quality));
+            estimates.emplace(quality, bytes);
+            return bytes;
+        };
+        
+        // Higher quality means a bigger output, so look for the highest score that still fits
+        auto search = [&](double scale, double limit) {
+            if (estimateFor(1.0) * scale <= limit) return 1.0;
+            if (estimateFor(0.0) * scale > limit) return 0.0;
+            double fitting = 0.0;
+            double tooBig = 1.0;
+            for (int step = 0; step < QUALITY_SEARCH_STEPS; ++step) {
+                double middle = (fitting + tooBig) / 2.0;
+                if (estimateFor(middle) * scale <= limit) {
+                    fitting = middle;
+                } else {
+                    tooBig = middle;
+                }
+            }
+            return fitting;
+        };
+        
+        // Prune, render and encode one pick - the tree itself stays as built for a retry
+        StageMeasurement encodeStage;
+        auto compressAt = [&](double quality) {
+            AdaptiveImageTree candidate(tree);
+            CompressionResult candidateResult = finishCompression(candidate, getConfigForQuality(quality), startTime);
+            
+            StageProbe encodeProbe;
+            candidateResult.compressedImage.saveToMemory(out);
+            encodeStage += encodeProbe.finish();
+            
+            candidateResult.qualityScore = quality;
+            candidateResult.encodedBytes = out.size();
+            return candidateResult;
+        };
+        
+        StageProbe searchProbe;
+        double quality = search(1.0, static_cast<double>(maxBytes));
+        StageMeasurement searchStage = searchProbe.finish();
+        CompressionResult result = compressAt(quality);
+        
+        // The estimate was off for this image - scale it by how far off it was and go again.
+        // The error drifts a little with quality, hence the headroom
+        if (out.size() > maxBytes && quality > 0.0) {
+            StageProbe retryProbe;
+            double scale = static_cast<double>(out.size()) / estimateFor(quality);
+            double retry = search(scale, RETRY_HEADROOM * maxBytes);
+            searchStage += retryProbe.finish();
+            result = compressAt(retry);
+        }
+        
+        result.stageMetrics[PipelineStage::Statistics] = statisticsStage;
+        result.stageMetrics[PipelineStage::TreeBuild] = buildStage;
+        result.stageMetrics[PipelineStage::Prune] += searchStage;
+        result.stageMetrics[PipelineStage::Encode] = encodeStage;
+        result.memoryUsage = memoryScope.usage();
+        return result;
+    }
+
+    void ImageCompressor::pruneForRender(AdaptiveImageTree& tree, const PruningConfig& config) {
+        tree.pruneTree(config);
+        
+        // Merge matching neighbours the tree couldn't collapse on its own
+        if (config.mergeAdjacentRegions) {
+            tree.mergeAdjacentRegions(config);
+        }
+    }
+
+    double ImageCompressor::measurePsnr(const AdaptiveImageTree& tree, const PruningConfig& config,
+                                        const SquaredErrorTable& errors) {
+        AdaptiveImageTree probe(tree);
+        pruneForRender(probe, config);
+        return errors.psnr(probe.squaredError(errors));
+    }
+
+    double ImageCompressor::estimateEncodedBytes(const AdaptiveImageTree& tree, const PruningConfig& config) {
+        AdaptiveImageTree probe(tree);
+        pruneForRender(probe, config);
+        RegionSummary summary = probe.summarizeRegions();
+        return BYTES_PER_REGION * summary.regions + BYTES_PER_COLOR * summary.colors +
+               BYTES_PER_EDGE_PIXEL * summary.edgeLength;
+    }
+
+    CompressionResult ImageCompressor::performCompression(const Utils::PNG& inputImage,
+                                                        const PruningConfig& config,
+                                                        const BuildConfig& buildConfig) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Utils::MemoryUsageScope memoryScope;
         
-        // Build the adaptive tree
-        AdaptiveImageTree tree(inputImage);
+        // Build the adaptive tree - the statistics only live until the tree is built,
+        // so they're gone again before pruning and rendering
+        StageProbe statisticsProbe;
+        auto statistics = std::make_unique<ImageStatistics>(inputImage);
+        StageMeasurement statisticsStage = statisticsProbe.finish();
         
+        // The time budget covers the statistics too - the tree gets whatever they left over
+        BuildConfig treeConfig = buildConfig;
+        if (treeConfig.timeBudgetSeconds > 0.0) {
+            treeConfig.timeBudgetSeconds = std::max(treeConfig.timeBudgetSeconds - statisticsStage.wallSeconds,
+                                                    std::numeric_limits<double>::min());
+        }
+        
+        StageProbe buildProbe;
+        AdaptiveImageTree tree(*statistics, treeConfig);
+        StageMeasurement buildStage = buildProbe.finish();
+        statistics.reset();
+        
+        CompressionResult result = finishCompression(tree, config, startTime);
+        result.stageMetrics[PipelineStage::Statistics] = statisticsStage;
+        result.stageMetrics[PipelineStage::TreeBuild] = buildStage;
+        return result;
+    }
+
+    CompressionResult ImageCompressor::finishCompression(AdaptiveImageTree& tree,
+                                                       const PruningConfig& config,
+                                                       std::chrono::high_resolution_clock::time_point startTime,
+                                                       const Utils::MutableImageView* output) {
         // Store original statistics
-        size_t originalPixels = static_cast<size_t>(inputImage.getWidth()) * inputImage.getHeight();
+        auto dimensions = tree.getImageDimensions();
+        size_t originalPixels = static_cast<size_t>(dimensions.first) * dimensions.second;
         
         // Prune the tree based on configuration
-        tree.pruneTree(config);
+        StageProbe pruneProbe;
+        pruneForRender(tree, config);
+        StageMeasurement pruneStage = pruneProbe.finish();
         
         // Render the compressed image
-        Utils::PNG compressedImage = tree.renderToImage();
+        StageProbe renderProbe;
+        Utils::PNG compressedImage;
+        if (output) {
+            tree.renderToBuffer(*output);
+        } else {
+            compressedImage = tree.renderToImage();
+        }
+        StageMeasurement renderStage = renderProbe.finish();
         
         // Calculate final statistics
-        size_t compressedRegions = tree.countLeafNodes();
+        size_t compressedRegions = tree.countRegions();
         double compressionRatio = tree.getCompressionRatio();
         
         auto endTime = std::chrono::high_resolution_clock::now();
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
         double processingTime = duration.count() / 1000.0; // Convert to seconds
         
-        return CompressionResult(compressedImage, compressionRatio, originalPixels,
-                               compressedRegions, processingTime);
+        // Callers opened a scope before building the tree, so this covers everything since
+        CompressionResult result(compressedImage, compressionRatio, originalPixels,
+                                 compressedRegions, processingTime);
+        result.memoryUsage = Utils::MemoryUsageScope().usage();
+        result.budgetExhausted = tree.budgetExhausted();
+        result.stageMetrics[PipelineStage::Prune] = pruneStage;
+        result.stageMetrics[PipelineStage::Render] = renderStage;
+        return result;
     }
 
 } // namespace ImageCompression 
\ No newline at end of file
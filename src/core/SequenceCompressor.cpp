@@ -0,0 +1,147 @@
+#include "../../include/core/SequenceCompressor.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace ImageCompression {
+
+    SequenceCompressor::SequenceCompressor(double qualityScore)
+        : SequenceCompressor(ImageCompressor::getConfigForQuality(qualityScore)) {}
+
+    SequenceCompressor::SequenceCompressor(const PruningConfig& config)
+        : config_(config), framesProcessed_(0) {}
+
+    void SequenceCompressor::reset() {
+        previousFrame_ = Utils::PNG();
+        statistics_.reset();
+        fullTree_.reset();
+        previousResult_.reset();
+        framesProcessed_ = 0;
+    }
+
+    CompressionResult SequenceCompressor::compressFrame(const Utils::PNG& frame) {
+        auto startTime = std::chrono::high_resolution_clock::now();
+        Utils::MemoryUsageScope memoryScope;
+        
+        bool sameSize = previousResult_ &&
+                        frame.getWidth() == previousFrame_.getWidth() &&
+                        frame.getHeight() == previousFrame_.getHeight();
+        
+        if (!sameSize) {
+            // First frame (or the size changed) - nothing to reuse, do the full job
+            statistics_ = std::make_unique<ImageStatistics>(frame);
+            fullTree_ = std::make_unique<AdaptiveImageTree>(*statistics_);
+        } else {
+            StageProbe diffProbe;
+            std::vector<Rectangle> changedRegions = findChangedRegions(previousFrame_, frame);
+            StageMeasurement diffStage = diffProbe.finish();
+            
+            if (changedRegions.empty()) {
+                // Nothing changed - hand back last frame's result, the diff was all the work
+                // Its stages and memory belong to the last frame, so only the diff gets reported
+                // (under statistics, which is what it stands in for)
+                CompressionResult result = *previousResult_;
+                result.stageMetrics = StageMetrics();
+                result.stageMetrics[PipelineStage::Statistics] = diffStage;
+                result.memoryUsage = memoryScope.usage();
+                auto endTime = std::chrono::high_resolution_clock::now();
+                result.processingTimeSeconds = std::chrono::duration<double>(endTime - startTime).count();
+                framesProcessed_++;
+                return result;
+            }
+            
+            statistics_->update(frame, changedRegions);
+            fullTree_->rebuildRegions(*statistics_, changedRegions);
+        }
+        
+        CompressionResult result = ImageCompressor::compressTree(*fullTree_, config_);
+        
+        auto endTime = std::chrono::high_resolution_clock::now();
+        result.processingTimeSeconds = std::chrono::duration<double>(endTime - startTime).count();
+        
+        previousFrame_ = frame;
+        previousResult_ = std::make_unique<CompressionResult>(result);
+        framesProcessed_++;
+        return result;
+    }
+
+    std::vector<Rectangle> SequenceCompressor::findChangedRegions(const Utils::PNG& previous,
+                                                                  const Utils::PNG& current) {
+        std::vector<Rectangle> changedRegions;
+        
+        int width = static_cast<int>(current.getWidth());
+        int height = static_cast<int>(current.getHeight());
+        if (current.isEmpty() || previous.getWidth() != current.getWidth() ||
+            previous.getHeight() != current.getHeight()) {
+            if (!current.isEmpty()) {
+                changedRegions.emplace_back(0, 0, width - 1, height - 1);
+            }
+            return changedRegions;
+        }
+        
+        int tileColumns = (width + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE;
+        std::vector<bool> tileChanged(tileColumns);
+        
+        // Rectangles from the previous band that can still grow downwards
+        std::vector<Rectangle> openRegions;
+        
+        for (int bandTop = 0; bandTop < height; bandTop += DIFF_TILE_SIZE) {
+            int bandBottom = std::min(bandTop + DIFF_TILE_SIZE, height) - 1;
+            std::fill(tileChanged.begin(), tileChanged.end(), false);
+            
+            // Frames decoded from the same bytes have bit-identical pixels, so memcmp is exact
+            for (int y = bandTop; y <= bandBottom; ++y) {
+                const Utils::HSLAPixel* previousRow = previous.getPixel(0, y);
+                const Utils::HSLAPixel* currentRow = current.getPixel(0, y);
+                
+                for (int tile = 0; tile < tileColumns; ++tile) {
+                    if (tileChanged[tile]) continue;
+                    
+                    int tileLeft = tile * DIFF_TILE_SIZE;
+                    int tileWidth = std::min(DIFF_TILE_SIZE, width - tileLeft);
+                    if (std::memcmp(previousRow + tileLeft, currentRow + tileLeft,
+                                    tileWidth * sizeof(Utils::HSLAPixel)) != 0) {
+                        tileChanged[tile] = true;
+                    }
+                }
+            }
+            
+            // Turn runs of changed tiles into rectangles, extending last band's when the span matches
+            std::vector<Rectangle> bandRegions;
+            for (int tile = 0; tile < tileColumns; ) {
+                if (!tileChanged[tile]) {
+                    ++tile;
+                    continue;
+                }
+                
+                int runStart = tile;
+                while (tile < tileColumns && tileChanged[tile]) ++tile;
+                
+                int left = runStart * DIFF_TILE_SIZE;
+                int right = std::min(tile * DIFF_TILE_SIZE, width) - 1;
+                
+                auto continued = std::find_if(openRegions.begin(), openRegions.end(),
+                    [&](const Rectangle& open) {
+                        return open.upperLeft.first == left && open.lowerRight.first == right;
+                    });
+                
+                if (continued != openRegions.end()) {
+                    Rectangle grown = *continued;
+                    grown.lowerRight.second = bandBottom;
+                    openRegions.erase(continued);
+                    bandRegions.push_back(grown);
+                } else {
+                    bandRegions.emplace_back(left, bandTop, right, bandBottom);
+                }
+            }
+            
+            // Anything not continued into this band is finished
+            changedRegions.insert(changedRegions.end(), openRegions.begin(), openRegions.end());
+            openRegions = std::move(bandRegions);
+        }
+        
+        changedRegions.insert(changedRegions.end(), openRegions.begin(), openRegions.end());
+        return changedRegions;
+    }
+
+} // namespace ImageCompression 
\ No newline at end of file
@@ -1,22 +1,124 @@
 #include "../include/core/ImageCompressor.h"
+#include "../include/core/SequenceCompressor.h"
+#include "../include/service/CompressionDaemon.h"
+#include "../include/cache/ResultCache.h"
+#include "../include/benchmark/ThreadScalingBenchmark.h"
+#include "../include/utils/threading/TaskScheduler.h"
+#include "../include/utils/threading/ThreadLimit.h"
 #include <iostream>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
 #include <string>
 #include <vector>
 #include <iomanip>
 #include <algorithm>
 #include <sstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <csignal>
+#include <cstdio>
+#include <cstdint>
 
 using namespace ImageCompression;
 
+std::string formatMegabytes(size_t bytes) {
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1) << (bytes / (1024.0 * 1024.0)) << " MB";
+    return text.str();
+}
+
+// Peak memory of the hungriest image, split by what it went on, then the whole process
+void printMemorySummary(const Utils::MemoryUsage& usage) {
+    if (usage.peakBytes > 0) {
+        std::cout << "Peak memory per image: " << formatMegabytes(usage.peakBytes) << " (";
+        for (size_t i = 0; i < Utils::MEMORY_OWNER_COUNT; ++i) {
+            Utils::MemoryOwner owner = static_cast<Utils::MemoryOwner>(i);
+            if (owner == Utils::MemoryOwner::Other) continue;
+            std::cout << (i > 0 ? ", " : "") << Utils::memoryOwnerName(owner) << " "
+                      << formatMegabytes(usage.peakFor(owner));
+        }
+        std::cout << ")\n";
+    }
+    
+    size_t peakResident = Utils::getPeakResidentBytes();
+    if (peakResident > 0) {
+        std::cout << "Peak resident memory: " << formatMegabytes(peakResident) << "\n";
+    }
+}
+
+// Counts get big quickly - 1234567 reads better as 1.23M
+std::string formatCount(uint64_t count) {
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(2);
+    if (count >= 1000000000ull) text << count / 1e9 << "G";
+    else if (count >= 1000000ull) text << count / 1e6 << "M";
+    else if (count >= 1000ull) text << count / 1e3 << "k";
+    else text << count;
+    return text.str();
+}
+
+// One line per stage the compression went through - counters only where we have them
+void printStageMetrics(const StageMetrics& metrics, const std::string& indent, std::ostream& out = std::cout) {
+    for (size_t i = 0; i < PIPELINE_STAGE_COUNT; ++i) {
+        PipelineStage stage = static_cast<PipelineStage>(i);
+        const StageMeasurement& measurement = metrics[stage];
+        if (!measurement.measured) continue;
+        
+        out << indent << std::left << std::setw(11) << pipelineStageName(stage) << std::right
+                  << std::fixed << std::setprecision(1) << std::setw(9)
+                  << (measurement.wallSeconds * 1000.0) << " ms";
+        
+        const Utils::PerfCounterValues& counters = measurement.counters;
+        for (size_t e = 0; e < Utils::PERF_EVENT_COUNT; ++e) {
+            Utils::PerfEvent event = static_cast<Utils::PerfEvent>(e);
+            if (counters.has(event)) {
+                out << "  " << Utils::perfEventName(event) << " " << formatCount(counters.get(event));
+            }
+        }
+        if (counters.instructionsPerCycle() > 0.0) {
+            out << "  IPC " << std::setprecision(2) << counters.instructionsPerCycle();
+        }
+        out << "\n";
+    }
+}
+
 void printUsage(const std::string& programName) {
     std::cout << "Content-Aware Image Compression Tool\n";
     std::cout << "====================================\n\n";
-    std::cout << "Usage: " << programName << " <input_dir> <output_dir> [quality]\n\n";
+    std::cout << "Usage: " << programName << " [options] <input_dir> <output_dir> [quality]\n";
+    std::cout << "       " << programName << " <input.png|-> <output.png|-> [quality]   (- = stdin/stdout)\n";
+    std::cout << "       " << programName << " --stream [quality]\n";
+    std::cout << "       " << programName << " --daemon <socket_path> [workers]\n";
+    std::cout << "       " << programName << " --benchmark [--csv <file>] <input_dir> [quality] [max_threads]\n\n";
     std::cout << "Arguments:\n";
     std::cout << "  input_dir   - Directory containing input PNG images\n";
     std::cout << "  output_dir  - Directory where compressed images will be saved\n";
     std::cout << "  quality     - Compression quality (optional, default: 0.5)\n\n";
+    std::cout << "Options:\n";
+    std::cout << "  --sequence  - Treat the images as frames (sorted by name) and only redo what changed\n";
+    std::cout << "  --stream    - Read length-prefixed PNGs from stdin, write length-prefixed results to stdout\n";
+    std::cout << "                (each PNG preceded by its size as a 4-byte big-endian integer)\n";
+    std::cout << "  --daemon    - Serve compression jobs over a Unix socket until interrupted\n";
+    std::cout << "  --cache <dir> - Reuse results for inputs already compressed with the same settings\n";
+    std::cout << "                (batch, pipes and --stream; not with a budget or quality target)\n";
+    std::cout << "  --merge-regions - Also paint neighbouring regions from different branches with one shared color\n";
+    std::cout << "                (they stay separate rectangles; not with a quality target or in --daemon)\n";
+    std::cout << "  --merge-tolerance <t> - --merge-regions with your own limit on how far colors in one group\n";
+    std::cout << "                may spread, in chroma/luminance/alpha (default: 0.05)\n";
+    std::cout << "  --perf      - Report time and hardware counters (cycles, IPC, cache/TLB/branch misses) per stage\n";
+    std::cout << "                (on stderr for pipes and --stream; not in --daemon)\n";
+    std::cout << "  --threads <n> - Most threads to use, across files and within each image (default: one per core)\n";
+    std::cout << "  --time-budget <ms> - Stop refining each image after this long and keep what's there\n";
+    std::cout << "                (most detailed regions first; per image in pipes and --stream, per job in --daemon)\n";
+    std::cout << "  --max-regions <n> - Same idea as a work budget: stop refining at n regions\n";
+    std::cout << "  --target-psnr <dB> - Pick the lowest quality per image whose PSNR still reaches this\n";
+    std::cout << "                (replaces the quality argument; per image in --stream too)\n";
+    std::cout << "  --target-size <bytes> - Pick the highest quality per image whose PNG fits in this many bytes\n";
+    std::cout << "                (replaces the quality argument; per image in --stream too)\n";
+    std::cout << "  --benchmark - Time each parallel stage and the whole batch at 1, 2, 4, ... threads\n";
+    std::cout << "  --csv <file> - With --benchmark, also write the results as CSV\n\n";
     std::cout << "Quality options:\n";
     std::cout << "  0.0 - 1.0   - Continuous quality scale (0.0 = maximum compression, 1.0 = minimal compression)\n";
     std::cout << "  highest     - Best quality, minimal compression (equivalent to 1.0)\n";
@@ -28,6 +130,16 @@ void printUsage(const std::string& programName) {
     std::cout << "  " << programName << " ./input ./output\n";
     std::cout << "  " << programName << " ./photos ./compressed 0.75\n";
     std::cout << "  " << programName << " ./photos ./compressed high\n";
+    std::cout << "  " << programName << " --sequence ./frames ./compressed 0.5\n";
+    std::cout << "  " << programName << " - - 0.5 < photo.png > small.png\n";
+    std::cout << "  " << programName << " --cache ~/.cache/compress ./photos ./compressed 0.5\n";
+    std::cout << "  " << programName << " --daemon /tmp/compress.sock 4\n";
+    std::cout << "  " << programName << " --perf ./photos ./compressed 0.5\n";
+    std::cout << "  " << programName << " --threads 4 ./photos ./compressed 0.5\n";
+    std::cout << "  " << programName << " --time-budget 50 ./photos ./compressed 0.5\n";
+    std::cout << "  " << programName << " --target-psnr 32 ./photos ./compressed\n";
+    std::cout << "  " << programName << " --target-size 100000 ./photos ./compressed\n";
+    std::cout << "  " << programName << " --benchmark --csv scaling.csv ./photos 0.5 16\n";
 }
 
 struct QualityValue {
@@ -83,6 +195,514 @@ std::vector<std::string> findPngFiles(const std::string& directory) {
     return pngFiles;
 }
 
+struct CommandLineOptions {
+    std::vector<std::string> positional;
+    bool sequenceMode = false;
+    bool daemonMode = false;
+    bool streamMode = false;
+    bool perfMode = false;
+    bool mergeRegions = false;
+    double mergeTolerance = PruningConfig().mergeColorTolerance;
+    bool benchmarkMode = false;
+    unsigned int threads = 0;   // 0 = one per hardware thread
+    double timeBudgetSeconds = 0.0;   // 0 = no budget
+    size_t maxRegions = 0;            // 0 = no limit
+    double targetPsnr = 0.0;          // dB, 0 = use the quality as given
+    size_t targetBytes = 0;           // 0 = use the quality as given
+    std::string cacheDirectory;
+    std::string csvPath;
+};
+
+CommandLineOptions parseArguments(int argc, char* argv[]) {
+    CommandLineOptions options;
+    
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument == "--sequence") {
+            options.sequenceMode = true;
+        } else if (argument == "--daemon") {
+            options.daemonMode = true;
+        } else if (argument == "--stream") {
+            options.streamMode = true;
+        } else if (argument == "--perf") {
+            options.perfMode = true;
+        } else if (argument == "--merge-regions") {
+            options.mergeRegions = true;
+        } else if (argument == "--merge-tolerance") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--merge-tolerance needs a number");
+            }
+            options.mergeTolerance = std::stod(argv[++i]);
+            if (options.mergeTolerance <= 0.0) {
+                throw std::invalid_argument("--merge-tolerance must be more than 0");
+            }
+            options.mergeRegions = true;
+        } else if (argument == "--cache") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--cache needs a directory");
+            }
+            options.cacheDirectory = argv[++i];
+        } else if (argument == "--threads") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--threads needs a number");
+            }
+            options.threads = static_cast<unsigned int>(std::stoul(argv[++i]));
+        } else if (argument == "--time-budget") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--time-budget needs a number of milliseconds");
+            }
+            double milliseconds = std::stod(argv[++i]);
+            if (milliseconds <= 0.0) {
+                throw std::invalid_argument("--time-budget must be more than 0 ms");
+            }
+            options.timeBudgetSeconds = milliseconds / 1000.0;
+        } else if (argument == "--max-regions") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--max-regions needs a number");
+            }
+            options.maxRegions = std::stoul(argv[++i]);
+        } else if (argument == "--target-psnr") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--target-psnr needs a value in dB");
+            }
+            options.targetPsnr = std::stod(argv[++i]);
+            if (options.targetPsnr <= 0.0) {
+                throw std::invalid_argument("--target-psnr must be more than 0 dB");
+            }
+        } else if (argument == "--target-size") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--target-size needs a number of bytes");
+            }
+            options.targetBytes = std::stoul(argv[++i]);
+            if (options.targetBytes == 0) {
+                throw std::invalid_argument("--target-size must be more than 0 bytes");
+            }
+        } else if (argument == "--benchmark") {
+            options.benchmarkMode = true;
+        } else if (argument == "--csv") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--csv needs a file");
+            }
+            options.csvPath = argv[++i];
+        } else if (argument.size() > 2 && argument.compare(0, 2, "--") == 0) {
+            throw std::invalid_argument("Unknown option: " + argument);
+        } else {
+            options.positional.push_back(argument);
+        }
+    }
+    
+    if (options.targetPsnr > 0.0 && options.targetBytes > 0) {
+        throw std::invalid_argument("--target-psnr and --target-size can't be used together");
+    }
+    
+    return options;
+}
+
+CompressionResult compressSequenceFrame(SequenceCompressor& compressor,
+                                        const std::string& inputPath,
+                                        const std::string& outputPath) {
+    Utils::PNG frame;
+    if (!frame.loadFromFile(inputPath)) {
+        throw std::runtime_error("Failed to load image from: " + inputPath);
+    }
+    
+    CompressionResult result = compressor.compressFrame(frame);
+    
+    if (!result.compressedImage.saveToFile(outputPath)) {
+        throw std::runtime_error("Failed to save compressed image to: " + outputPath);
+    }
+    
+    return result;
+}
+
+CompressionResult compressFileToQuality(const std::string& inputPath, const std::string& outputPath,
+                                        double targetPsnr) {
+    Utils::PNG inputImage;
+    if (!inputImage.loadFromFile(inputPath)) {
+        throw std::runtime_error("Failed to load image from: " + inputPath);
+    }
+    
+    CompressionResult result = ImageCompressor::compressToQuality(inputImage, targetPsnr);
+    
+    if (!result.compressedImage.saveToFile(outputPath)) {
+        throw std::runtime_error("Failed to save compressed image to: " + outputPath);
+    }
+    
+    return result;
+}
+
+std::vector<uint8_t> readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to load image from: " + path);
+    }
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+// For PNGs that are already encoded
+void writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()))) {
+        throw std::runtime_error("Failed to save compressed image to: " + path);
+    }
+}
+
+CompressionResult compressFileToSize(const std::string& inputPath, const std::string& outputPath,
+                                     size_t maxBytes) {
+    Utils::PNG inputImage;
+    if (!inputImage.loadFromFile(inputPath)) {
+        throw std::runtime_error("Failed to load image from: " + inputPath);
+    }
+    
+    std::vector<uint8_t> encoded;
+    CompressionResult result = ImageCompressor::compressToSize(inputImage, maxBytes, encoded);
+    writeFile(outputPath, encoded);
+    
+    return result;
+}
+
+// ", quality 0.43, 32.1 dB" or ", quality 0.62, 48213 bytes" when the quality was searched for
+std::string describeSearchedQuality(const CompressionResult& result) {
+    if (result.qualityScore < 0.0) return "";
+    
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(2) << ", quality " << result.qualityScore;
+    if (result.psnr > 0.0) text << ", " << std::setprecision(1) << result.psnr << " dB";
+    if (result.encodedBytes > 0) text << ", " << result.encodedBytes << " bytes";
+    return text.str();
+}
+
+// The running daemon, so a signal can ask it to shut down cleanly
+CompressionDaemon* activeDaemon = nullptr;
+
+void handleStopSignal(int) {
+    if (activeDaemon) activeDaemon->stop();
+}
+
+int runDaemon(const CommandLineOptions& options) {
+    if (options.positional.empty() || options.positional.size() > 2) {
+        return -1;
+    }
+    
+    size_t workers = 2;
+    if (options.positional.size() == 2) {
+        workers = std::stoul(options.positional[1]);
+    }
+    
+    if (!options.cacheDirectory.empty()) {
+        std::cerr << "Warning: --cache is ignored in daemon mode\n";
+    }
+    if (options.mergeRegions) {
+        std::cerr << "Warning: --merge-regions is ignored in daemon mode\n";
+    }
+    if (options.perfMode) {
+        std::cerr << "Warning: --perf is ignored in daemon mode\n";
+    }
+    
+    DaemonConfig config(options.positional[0], workers);
+    config.timeBudgetSeconds = options.timeBudgetSeconds;
+    CompressionDaemon daemon(config);
+    activeDaemon = &daemon;
+    std::signal(SIGINT, handleStopSignal);
+    std::signal(SIGTERM, handleStopSignal);
+    
+    std::cout << "Daemon listening on " << options.positional[0] << " with " << daemon.getWorkerCount()
+              << " worker(s)";
+    if (daemon.getWorkerCount() < workers) {
+        std::cout << " (capped at the thread limit)";
+    }
+    std::cout << "\n";
+    std::cout.flush();
+    daemon.run();
+    activeDaemon = nullptr;
+    
+    std::cout << "Daemon stopped\n";
+    return 0;
+}
+
+PruningConfig getConfigForQuality(const QualityValue& qualityValue, const CommandLineOptions& options) {
+    PruningConfig config = qualityValue.isFloat
+        ? ImageCompressor::getConfigForQuality(qualityValue.floatValue)
+        : ImageCompressor::getConfigForQuality(qualityValue.enumValue);
+    config.mergeAdjacentRegions = options.mergeRegions;
+    config.mergeColorTolerance = options.mergeTolerance;
+    return config;
+}
+
+// "-" stands for stdin/stdout instead of a path
+bool isStandardStream(const std::string& path) {
+    return path == "-";
+}
+
+std::vector<unsigned char> readAll(std::FILE* input) {
+    std::vector<unsigned char> data;
+    unsigned char buffer[65536];
+    size_t bytesRead;
+    while ((bytesRead = std::fread(buffer, 1, sizeof(buffer), input)) > 0) {
+        data.insert(data.end(), buffer, buffer + bytesRead);
+    }
+    if (std::ferror(input)) {
+        throw std::runtime_error("Failed to read from stdin");
+    }
+    return data;
+}
+
+// Returns false on a clean end of input (nothing read); a partial read is an error
+bool readExact(std::FILE* input, unsigned char* data, size_t size) {
+    size_t bytesRead = std::fread(data, 1, size, input);
+    if (bytesRead == 0 && std::feof(input)) return false;
+    if (bytesRead != size) {
+        throw std::runtime_error("Truncated input on stdin");
+    }
+    return true;
+}
+
+void writeAll(std::FILE* output, const unsigned char* data, size_t size) {
+    if (std::fwrite(data, 1, size, output) != size) {
+        throw std::runtime_error("Failed to write to stdout");
+    }
+}
+
+void reportStreamResult(const CompressionResult& result, bool perf) {
+    // A cache hit never decodes anything, so there's only the pixel count to go on
+    if (result.servedFromCache) {
+        std::cerr << "✓ " << result.originalPixels << " pixels";
+    } else {
+        std::cerr << "✓ " << result.compressedImage.getWidth() << "x" << result.compressedImage.getHeight();
+    }
+    std::cerr << " (" << std::fixed << std::setprecision(1) << (result.compressionRatio * 100)
+              << "% compression, " << std::setprecision(2) << result.processingTimeSeconds << "s"
+              << (result.servedFromCache ? ", cached" : "")
+              << (result.budgetExhausted ? ", budget reached" : "")
+              << describeSearchedQuality(result) << ")\n";
+    if (perf) {
+        printStageMetrics(result.stageMetrics, "    ", std::cerr);
+    }
+}
+
+// Turn the counters on for --perf and say what we got
+void startPerfCounters(std::ostream& out) {
+    bool counting = Utils::enablePerfCounters();
+    std::string reason = Utils::perfCountersUnavailableReason();
+    if (!counting) {
+        out << "Hardware counters: unavailable (" << reason << "), reporting stage times only\n";
+    } else if (!reason.empty()) {
+        out << "Hardware counters: on, some events missing (" << reason << ")\n";
+    } else {
+        out << "Hardware counters: on\n";
+    }
+}
+
+// Encoded PNG to stdout or a file
+void writeEncoded(const std::string& outputPath, const std::vector<unsigned char>& encoded) {
+    if (isStandardStream(outputPath)) {
+        writeAll(stdout, encoded.data(), encoded.size());
+        std::fflush(stdout);
+    } else {
+        writeFile(outputPath, encoded);
+    }
+}
+
+// Pipes and --stream go through the cache like batch mode, and skip it in the same cases
+std::unique_ptr<ResultCache> openCache(const CommandLineOptions& options) {
+    if (options.cacheDirectory.empty()) {
+        return nullptr;
+    }
+    if (options.timeBudgetSeconds > 0.0 || options.maxRegions > 0) {
+        std::cerr << "Warning: --cache is ignored with a budget\n";
+        return nullptr;
+    }
+    if (options.targetPsnr > 0.0 || options.targetBytes > 0) {
+        std::cerr << "Warning: --cache is ignored with a quality target\n";
+        return nullptr;
+    }
+    return std::make_unique<ResultCache>(options.cacheDirectory);
+}
+
+// Single image where the input and/or the output is a pipe - stdout carries only PNG data,
+// so everything meant for a person goes to stderr
+int runSingleImage(const std::string& inputPath, const std::string& outputPath,
+                   const PruningConfig& config, const BuildConfig& buildConfig,
+                   double targetPsnr, size_t targetBytes, ResultCache* cache, bool perf) {
+    // The cache is keyed on the raw input bytes, so a hit never decodes anything
+    if (cache) {
+        std::vector<unsigned char> inputBytes = isStandardStream(inputPath) ? readAll(stdin) : readFile(inputPath);
+        std::vector<unsigned char> encoded;
+        CompressionResult result = ImageCompressor::compressBuffer(inputBytes.data(), inputBytes.size(),
+                                                                   encoded, config, *cache);
+        writeEncoded(outputPath, encoded);
+        reportStreamResult(result, perf);
+        return 0;
+    }
+    
+    Utils::PNG inputImage;
+    if (isStandardStream(inputPath)) {
+        std::vector<unsigned char> encoded = readAll(stdin);
+        inputImage.loadFromMemory(encoded.data(), encoded.size());
+    } else if (!inputImage.loadFromFile(inputPath)) {
+        throw std::runtime_error("Failed to load image from: " + inputPath);
+    }
+    
+    // The quality searches build their own tree once and reuse it, like batch mode
+    if (buildConfig.hasBudget() && (targetBytes > 0 || targetPsnr > 0.0)) {
+        std::cerr << "Warning: --time-budget and --max-regions are ignored with a quality target\n";
+    }
+    if (config.mergeAdjacentRegions && (targetBytes > 0 || targetPsnr > 0.0)) {
+        std::cerr << "Warning: --merge-regions is ignored with a quality target\n";
+    }
+    
+    // A size target already comes back encoded
+    std::vector<unsigned char> encoded;
+    CompressionResult result = targetBytes > 0
+        ? ImageCompressor::compressToSize(inputImage, targetBytes, encoded)
+        : targetPsnr > 0.0
+        ? ImageCompressor::compressToQuality(inputImage, targetPsnr)
+        : ImageCompressor::compressImage(inputImage, config, buildConfig);
+    
+    if (targetBytes == 0) result.compressedImage.saveToMemory(encoded);
+    writeEncoded(outputPath, encoded);
+    
+    reportStreamResult(result, perf);
+    return 0;
+}
+
+// The search needs the decoded pixels, so unlike compressBuffer this decodes and encodes here
+CompressionResult compressBufferToQuality(const std::vector<uint8_t>& input, std::vector<uint8_t>& output,
+                                          double targetPsnr) {
+    Utils::PNG inputImage;
+    inputImage.loadFromMemory(input.data(), input.size());
+    CompressionResult result = ImageCompressor::compressToQuality(inputImage, targetPsnr);
+    result.compressedImage.saveToMemory(output);
+    return result;
+}
+
+// A size target comes back already encoded into output
+CompressionResult compressBufferToSize(const std::vector<uint8_t>& input, std::vector<uint8_t>& output,
+                                       size_t targetBytes) {
+    Utils::PNG inputImage;
+    inputImage.loadFromMemory(input.data(), input.size());
+    return ImageCompressor::compressToSize(inputImage, targetBytes, output);
+}
+
+// Any number of PNGs on stdin, each preceded by its size as a 4-byte big-endian integer;
+// results come back on stdout framed the same way, one per input, in order
+// With a PSNR or size target each image gets its own quality, the same as in batch mode
+int runStream(const PruningConfig& config, const BuildConfig& buildConfig,
+              double targetPsnr, size_t targetBytes, ResultCache* cache, bool perf) {
+    if (buildConfig.hasBudget() && (targetBytes > 0 || targetPsnr > 0.0)) {
+        std::cerr << "Warning: --time-budget and --max-regions are ignored with a quality target\n";
+    }
+    if (config.mergeAdjacentRegions && (targetBytes > 0 || targetPsnr > 0.0)) {
+        std::cerr << "Warning: --merge-regions is ignored with a quality target\n";
+    }
+    
+    // Both buffers are reused across images so steady streams stop allocating
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> output;
+    size_t processed = 0;
+    StageMetrics totalStageMetrics;
+    
+    unsigned char header[4];
+    while (readExact(stdin, header, sizeof(header))) {
+        uint32_t size = (static_cast<uint32_t>(header[0]) << 24) | (static_cast<uint32_t>(header[1]) << 16) |
+                        (static_cast<uint32_t>(header[2]) << 8) | static_cast<uint32_t>(header[3]);
+        input.resize(size);
+        if (size > 0 && !readExact(stdin, input.data(), size)) {
+            throw std::runtime_error("Truncated input on stdin");
+        }
+        
+        CompressionResult result = targetBytes > 0
+            ? compressBufferToSize(input, output, targetBytes)
+            : targetPsnr > 0.0
+            ? compressBufferToQuality(input, output, targetPsnr)
+            : cache
+            ? ImageCompressor::compressBuffer(input.data(), input.size(), output, config, *cache)
+            : ImageCompressor::compressBuffer(input.data(), input.size(), output, config, buildConfig);
+        
+        uint32_t outputSize = static_cast<uint32_t>(output.size());
+        unsigned char outputHeader[4] = {
+            static_cast<unsigned char>(outputSize >> 24), static_cast<unsigned char>(outputSize >> 16),
+            static_cast<unsigned char>(outputSize >> 8), static_cast<unsigned char>(outputSize)
+        };
+        writeAll(stdout, outputHeader, sizeof(outputHeader));
+        writeAll(stdout, output.data(), output.size());
+        std::fflush(stdout);  // The other end may be waiting on this one before sending the next
+        
+        processed++;
+        reportStreamResult(result, perf);
+        if (perf) totalStageMetrics += result.stageMetrics;
+    }
+    
+    std::cerr << "Stream finished: " << processed << " image(s)\n";
+    if (perf && processed > 0) {
+        std::cerr << "Stages (all images):\n";
+        printStageMetrics(totalStageMetrics, "  ", std::cerr);
+    }
+    return 0;
+}
+
+// Compress one corpus at 1, 2, 4, ... threads and print how each stage scales
+int runBenchmark(const CommandLineOptions& options) {
+    if (options.positional.empty() || options.positional.size() > 3) {
+        return -1;
+    }
+    
+    QualityValue qualityValue = {true, 0.5, CompressionQuality::MEDIUM_QUALITY};
+    if (options.positional.size() >= 2) {
+        qualityValue = parseQuality(options.positional[1]);
+    }
+    unsigned int maxThreads = 0;
+    if (options.positional.size() == 3) {
+        maxThreads = static_cast<unsigned int>(std::stoul(options.positional[2]));
+    }
+    
+    BenchmarkConfig config(options.positional[0], getConfigForQuality(qualityValue, options),
+                           maxThreads);
+    config.csvPath = options.csvPath;
+    
+    std::cout << "Thread scaling benchmark: " << config.inputDirectory << " (best of "
+              << config.repetitions << " runs per thread count)\n\n";
+    
+    ThreadScalingBenchmark benchmark(config);
+    std::vector<ScalingSample> samples = benchmark.run();
+    ThreadScalingBenchmark::printTables(samples, std::cout);
+    
+    if (!config.csvPath.empty()) {
+        std::ofstream csv(config.csvPath);
+        if (!csv) {
+            throw std::runtime_error("Failed to write CSV to: " + config.csvPath);
+        }
+        ThreadScalingBenchmark::writeCsv(samples, csv);
+        std::cout << "CSV written to: " << config.csvPath << "\n";
+    }
+    
+    std::cout << "FastHash throughput:";
+    const char* hashSeparator = " ";
+    for (const HashThroughputSample& sample : benchmark.hashThroughput()) {
+        std::cout << hashSeparator << std::fixed << std::setprecision(2) << sample.gigabytesPerSecond
+                  << " GB/s at " << sample.threads << (sample.threads == 1 ? " thread" : " threads");
+        hashSeparator = ", ";
+    }
+    std::cout << "\n";
+    
+    // Building a tree is meant to stay off the heap once the node pools are warm
+    size_t treeBuildAllocations = 0;
+    std::cout << "Heap allocations per tree build after warm-up:";
+    const char* separator = " ";
+    for (const AllocationSample& sample : benchmark.treeBuildAllocations()) {
+        std::cout << separator << sample.allocations << " at " << sample.threads
+                  << (sample.threads == 1 ? " thread" : " threads");
+        separator = ", ";
+        treeBuildAllocations = std::max(treeBuildAllocations, sample.allocations);
+    }
+    std::cout << "\n";
+    if (treeBuildAllocations > 0) {
+        std::cerr << "Error: the tree build allocated after warm-up (expected none)\n";
+        return 1;
+    }
+    return 0;
+}
+
 void createOutputDirectory(const std::string& outputDir) {
     if (!std::filesystem::exists(outputDir)) {
         std::filesystem::create_directories(outputDir);
@@ -93,17 +713,58 @@ void createOutputDirectory(const std::string& outputDir) {
 int main(int argc, char* argv[]) {
     try {
         // Parse command line arguments
-        if (argc < 3 || argc > 4) {
+        CommandLineOptions options = parseArguments(argc, argv);
+        Utils::setThreadLimit(options.threads);
+        if (options.daemonMode) {
+            int status = runDaemon(options);
+            if (status < 0) printUsage(argv[0]);
+            return status < 0 ? 1 : status;
+        }
+        
+        if (options.benchmarkMode) {
+            int status = runBenchmark(options);
+            if (status < 0) printUsage(argv[0]);
+            return status < 0 ? 1 : status;
+        }
+        
+        // Every mode that builds each tree from scratch honours the budget
+        BuildConfig budgetConfig(options.timeBudgetSeconds, options.maxRegions);
+        
+        if (options.streamMode) {
+            if (options.positional.size() > 1) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            QualityValue streamQuality = {true, 0.5, CompressionQuality::MEDIUM_QUALITY};
+            if (options.positional.size() == 1) {
+                streamQuality = parseQuality(options.positional[0]);
+            }
+            std::unique_ptr<ResultCache> resultCache = openCache(options);
+            if (options.perfMode) startPerfCounters(std::cerr);
+            return runStream(getConfigForQuality(streamQuality, options), budgetConfig,
+                             options.targetPsnr, options.targetBytes, resultCache.get(), options.perfMode);
+        }
+        
+        if (options.positional.size() < 2 || options.positional.size() > 3) {
             printUsage(argv[0]);
             return 1;
         }
         
-        std::string inputDir = argv[1];
-        std::string outputDir = argv[2];
+        std::string inputDir = options.positional[0];
+        std::string outputDir = options.positional[1];
         QualityValue qualityValue = {true, 0.5, CompressionQuality::MEDIUM_QUALITY}; // Default to 0.5
         
-        if (argc == 4) {
-            qualityValue = parseQuality(argv[3]);
+        if (options.positional.size() == 3) {
+            qualityValue = parseQuality(options.positional[2]);
+        }
+        
+        // Pipes carry a single image rather than a directory
+        if (isStandardStream(inputDir) || isStandardStream(outputDir)) {
+            std::unique_ptr<ResultCache> resultCache = openCache(options);
+            if (options.perfMode) startPerfCounters(std::cerr);
+            return runSingleImage(inputDir, outputDir, getConfigForQuality(qualityValue, options),
+                                  budgetConfig, options.targetPsnr, options.targetBytes, resultCache.get(),
+                                  options.perfMode);
         }
         
         // Create output directory if it doesn't exist
@@ -117,29 +778,110 @@ int main(int argc, char* argv[]) {
             return 0;
         }
         
+        // Frames are pruned against the tree the last frame left, which a per-image search can't use
+        bool targeting = options.targetPsnr > 0.0 || options.targetBytes > 0;
+        if (targeting && options.sequenceMode) {
+            std::cerr << "Warning: --target-psnr and --target-size are ignored in sequence mode\n";
+            targeting = false;
+        }
+        if (targeting && options.mergeRegions) {
+            std::cerr << "Warning: --merge-regions is ignored with a quality target\n";
+        }
+        
         std::cout << "Found " << pngFiles.size() << " PNG file(s) to compress\n";
-        if (qualityValue.isFloat) {
+        if (targeting && options.targetBytes > 0) {
+            std::cout << "Quality: highest fitting in " << options.targetBytes << " bytes, chosen per image\n";
+        } else if (targeting) {
+            std::cout << "Quality: lowest reaching " << std::fixed << std::setprecision(1)
+                      << options.targetPsnr << " dB PSNR, chosen per image\n";
+        } else if (qualityValue.isFloat) {
             std::cout << "Quality: " << std::fixed << std::setprecision(2) << qualityValue.floatValue 
                      << " (" << ImageCompressor::getQualityName(qualityValue.floatValue) << ")\n";
         } else {
             std::cout << "Quality: " << ImageCompressor::getQualityName(qualityValue.enumValue) << "\n";
         }
-        std::cout << "Output directory: " << outputDir << "\n\n";
+        std::cout << "Output directory: " << outputDir << "\n";
+        
+        // Frames only help each other in order, so sort them by name
+        std::unique_ptr<SequenceCompressor> sequenceCompressor;
+        if (options.sequenceMode) {
+            std::sort(pngFiles.begin(), pngFiles.end());
+            sequenceCompressor = std::make_unique<SequenceCompressor>(
+                getConfigForQuality(qualityValue, options));
+            std::cout << "Mode: frame sequence\n";
+        }
+        
+        // A budget only bounds a full tree build, and frames mostly reuse the last one
+        bool budgeted = budgetConfig.hasBudget();
+        if (budgeted) {
+            if (options.sequenceMode) {
+                std::cerr << "Warning: --time-budget and --max-regions are ignored in sequence mode\n";
+                budgeted = false;
+            } else if (targeting) {
+                std::cerr << "Warning: --time-budget and --max-regions are ignored with a quality target\n";
+                budgeted = false;
+            } else {
+                std::cout << "Budget per image:";
+                if (options.timeBudgetSeconds > 0.0) {
+                    std::cout << " " << std::fixed << std::setprecision(1)
+                              << (options.timeBudgetSeconds * 1000.0) << " ms";
+                }
+                if (options.maxRegions > 0) {
+                    std::cout << " " << options.maxRegions << " regions";
+                }
+                std::cout << "\n";
+            }
+        }
+        
+        // Frames depend on each other, so whole results can't be cached per file - and a
+        // budgeted result depends on how busy the machine was, so it isn't worth keeping
+        std::unique_ptr<ResultCache> resultCache;
+        if (!options.cacheDirectory.empty()) {
+            if (options.sequenceMode) {
+                std::cerr << "Warning: --cache is ignored in sequence mode\n";
+            } else if (budgeted) {
+                std::cerr << "Warning: --cache is ignored with a budget\n";
+            } else if (targeting) {
+                std::cerr << "Warning: --cache is ignored with a quality target\n";
+            } else {
+                resultCache = std::make_unique<ResultCache>(options.cacheDirectory);
+                std::cout << "Cache: " << options.cacheDirectory << "\n";
+            }
+        }
+        
+        if (options.perfMode) {
+            startPerfCounters(std::cout);
+        }
+        std::cout << "\n";
         
         // Process each image
         size_t processed = 0;
+        size_t cacheHits = 0;
+        size_t budgetsReached = 0;
+        size_t targetsReached = 0;
         double totalTime = 0.0;
+        Utils::MemoryUsage largestMemoryUsage;   // From the image that needed the most
+        StageMetrics totalStageMetrics;
         size_t totalOriginalPixels = 0;
         size_t totalCompressedRegions = 0;
         
-        for (const std::string& inputPath : pngFiles) {
+        // Each file's line is put together first and printed whole, since files
+        // finish in any order when several are compressed at once
+        std::mutex reportMutex;
+        auto compressFile = [&](const std::string& inputPath) {
             std::filesystem::path inputFile(inputPath);
             std::string filename = inputFile.filename().string();
             
             // Create output filename with quality suffix
             std::string baseName = inputFile.stem().string();
             std::string qualitySuffix;
-            if (qualityValue.isFloat) {
+            if (targeting && options.targetBytes > 0) {
+                qualitySuffix = std::to_string(options.targetBytes) + "b";
+            } else if (targeting) {
+                std::ostringstream oss;
+                oss << "psnr" << std::fixed << std::setprecision(1) << options.targetPsnr;
+                qualitySuffix = oss.str();
+            } else if (qualityValue.isFloat) {
                 std::ostringstream oss;
                 oss << std::fixed << std::setprecision(2) << qualityValue.floatValue;
                 qualitySuffix = oss.str();
@@ -149,32 +891,94 @@ int main(int argc, char* argv[]) {
             std::string outputFilename = baseName + "_q" + qualitySuffix + ".png";
             std::string outputPath = std::filesystem::path(outputDir) / outputFilename;
             
-            std::cout << "Processing: " << filename << " -> " << outputFilename << " ... ";
-            std::cout.flush();
+            std::ostringstream report;
+            report << "Processing: " << filename << " -> " << outputFilename << " ... ";
             
             try {
-                CompressionResult result = qualityValue.isFloat 
+                CompressionResult result = sequenceCompressor
+                    ? compressSequenceFrame(*sequenceCompressor, inputPath, outputPath)
+                    : targeting && options.targetBytes > 0
+                    ? compressFileToSize(inputPath, outputPath, options.targetBytes)
+                    : targeting
+                    ? compressFileToQuality(inputPath, outputPath, options.targetPsnr)
+                    : budgeted
+                    ? ImageCompressor::compressImageFile(inputPath, outputPath,
+                                                         getConfigForQuality(qualityValue, options),
+                                                         budgetConfig)
+                    : resultCache
+                    ? ImageCompressor::compressImageFile(inputPath, outputPath,
+                                                         getConfigForQuality(qualityValue, options), *resultCache)
+                    : options.mergeRegions
+                    ? ImageCompressor::compressImageFile(inputPath, outputPath,
+                                                         getConfigForQuality(qualityValue, options),
+                                                         BuildConfig())
+                    : qualityValue.isFloat 
                     ? ImageCompressor::compressImageFile(inputPath, outputPath, qualityValue.floatValue)
                     : ImageCompressor::compressImageFile(inputPath, outputPath, qualityValue.enumValue);
                 
+                report << "✓ (" << std::fixed << std::setprecision(1) 
+                       << (result.compressionRatio * 100) << "% compression, "
+                       << std::setprecision(2) << result.processingTimeSeconds << "s"
+                       << (result.servedFromCache ? ", cached" : "")
+                       << (result.budgetExhausted ? ", budget reached" : "")
+                       << describeSearchedQuality(result) << ")\n";
+                if (options.perfMode) {
+                    printStageMetrics(result.stageMetrics, "    ", report);
+                }
+                
+                std::lock_guard<std::mutex> lock(reportMutex);
                 processed++;
                 totalTime += result.processingTimeSeconds;
                 totalOriginalPixels += result.originalPixels;
                 totalCompressedRegions += result.compressedRegions;
-                
-                std::cout << "✓ (" << std::fixed << std::setprecision(1) 
-                         << (result.compressionRatio * 100) << "% compression, "
-                         << std::setprecision(2) << result.processingTimeSeconds << "s)\n";
+                if (result.memoryUsage.peakBytes > largestMemoryUsage.peakBytes) {
+                    largestMemoryUsage = result.memoryUsage;
+                }
+                if (result.servedFromCache) cacheHits++;
+                if (result.budgetExhausted) budgetsReached++;
+                if (targeting && (options.targetBytes > 0 ? result.encodedBytes <= options.targetBytes
+                                                          : result.psnr >= options.targetPsnr)) {
+                    targetsReached++;
+                }
+                if (options.perfMode) totalStageMetrics += result.stageMetrics;
+                std::cout << report.str() << std::flush;
                 
             } catch (const std::exception& e) {
-                std::cout << "✗ Error: " << e.what() << "\n";
+                report << "✗ Error: " << e.what() << "\n";
+                std::lock_guard<std::mutex> lock(reportMutex);
+                std::cout << report.str() << std::flush;
+            }
+        };
+        
+        if (sequenceCompressor) {
+            // Frames build on each other, so they go strictly in order
+            for (const std::string& inputPath : pngFiles) {
+                compressFile(inputPath);
+            }
+        } else {
+            // Files share the scheduler with the stages inside each compression,
+            // so both levels together never use more than --threads threads
+            Utils::TaskGroup files;
+            for (const std::string& inputPath : pngFiles) {
+                files.run([&compressFile, &inputPath]() { compressFile(inputPath); });
             }
+            files.wait();
         }
         
         // Print summary
         std::cout << "\n=== Compression Summary ===\n";
         std::cout << "Files processed: " << processed << "/" << pngFiles.size() << "\n";
         std::cout << "Total processing time: " << std::fixed << std::setprecision(2) << totalTime << " seconds\n";
+        if (resultCache) {
+            std::cout << "Cache hits: " << cacheHits << "/" << processed << "\n";
+        }
+        if (targeting) {
+            std::cout << (options.targetBytes > 0 ? "Size" : "PSNR") << " target reached: "
+                      << targetsReached << "/" << processed << "\n";
+        }
+        if (budgeted) {
+            std::cout << "Stopped at the budget: " << budgetsReached << "/" << processed << "\n";
+        }
         
         if (processed > 0) {
             double avgCompressionRatio = static_cast<double>(totalCompressedRegions) / totalOriginalPixels;
@@ -183,6 +987,12 @@ int main(int argc, char* argv[]) {
             std::cout << "Average time per image: " << std::setprecision(2) 
                      << (totalTime / processed) << " seconds\n";
         }
+        printMemorySummary(largestMemoryUsage);
+        
+        if (options.perfMode && processed > 0) {
+            std::cout << "Stages (all images):\n";
+            printStageMetrics(totalStageMetrics, "  ");
+        }
         
         std::cout << "\nCompression complete! Check output directory: " << outputDir << "\n";
         
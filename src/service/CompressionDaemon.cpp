@@ -0,0 +1,408 @@
+#include "../../include/service/CompressionDaemon.h"
+#include "../../include/statistics/ImageStatistics.h"
+#include "../../include/utils/threading/ThreadLimit.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace ImageCompression {
+
+    namespace {
+        
+        double secondsSince(std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        
+        std::vector<std::string> splitFields(const std::string& line) {
+            std::vector<std::string> fields;
+            std::string field;
+            std::istringstream stream(line);
+            while (std::getline(stream, field, '\t')) {
+                fields.push_back(field);
+            }
+            return fields;
+        }
+
+    } // namespace
+
+    CompressionDaemon::CompressionDaemon(const DaemonConfig& config)
+        : config_(config), listenSocket_(-1), stopRequested_(false), acceptingJobs_(true),
+          jobsCompleted_(0), jobsFailed_(0) {
+        if (config_.workerCount == 0) config_.workerCount = 1;
+        config_.workerCount = std::min<size_t>(config_.workerCount, Utils::getThreadLimit());
+        if (config_.queueCapacity == 0) config_.queueCapacity = 1;
+        if (config_.maxConnections == 0) config_.maxConnections = 1;
+    }
+
+    CompressionDaemon::~CompressionDaemon() {
+        closeSocket();
+    }
+
+    void CompressionDaemon::stop() {
+        stopRequested_.store(true);
+    }
+
+    void CompressionDaemon::run() {
+        openSocket();
+        
+        // Every worker is a thread of its own on top of the scheduler's, so the stages inside
+        // each job only get the threads the workers leave - together they stay within the limit.
+        // With as many workers as threads, each job runs on its worker alone
+        unsigned int threadLimit = Utils::getThreadLimit();
+        Utils::setThreadLimit(threadLimit - static_cast<unsigned int>(config_.workerCount) + 1);
+        
+        for (size_t i = 0; i < config_.workerCount; ++i) {
+            workers_.emplace_back(&CompressionDaemon::workerLoop, this);
+        }
+        
+        while (!stopRequested_.load()) {
+            pollfd listenPoll = {listenSocket_, POLLIN, 0};
+            int ready = poll(&listenPoll, 1, ACCEPT_POLL_MILLISECONDS);
+            reapFinishedConnections();
+            if (ready <= 0) continue;  // Timeout or a signal - go check the stop flag
+            
+            int clientSocket = accept(listenSocket_, nullptr, nullptr);
+            if (clientSocket < 0) continue;
+            
+            // Every client holds two threads until it hangs up, so turn the extra ones away
+            if (connections_.size() >= config_.maxConnections) {
+                sendAll(clientSocket, "ERR too many connections\n");
+                close(clientSocket);
+                continue;
+            }
+            
+            auto connection = std::make_unique<Connection>();
+            connection->socket = clientSocket;
+            Connection& added = *connection;
+            connections_.push_back(std::move(connection));
+            added.thread = std::thread(&CompressionDaemon::serveConnection, this, std::ref(added));
+        }
+        
+        // Stop taking new work, let the workers drain what's already queued
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            acceptingJobs_ = false;
+        }
+        jobAvailable_.notify_all();
+        spaceAvailable_.notify_all();
+        
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+        workers_.clear();
+        
+        // Wake up clients still blocked in recv so their threads can finish
+        for (auto& connection : connections_) {
+            shutdown(connection->socket, SHUT_RDWR);
+        }
+        for (auto& connection : connections_) {
+            connection->thread.join();
+            close(connection->socket);
+        }
+        connections_.clear();
+        
+        closeSocket();
+        Utils::setThreadLimit(threadLimit);
+    }
+
+    void CompressionDaemon::openSocket() {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (config_.socketPath.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("Socket path too long: " + config_.socketPath);
+        }
+        std::strncpy(address.sun_path, config_.socketPath.c_str(), sizeof(address.sun_path) - 1);
+        
+        // A socket file left behind by a previous run would make bind fail - but never
+        // delete anything that isn't a socket
+        struct stat existing;
+        if (stat(config_.socketPath.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+            unlink(config_.socketPath.c_str());
+        }
+        
+        listenSocket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenSocket_ < 0) {
+            throw std::runtime_error("Failed to create socket: " + std::system_category().message(errno));
+        }
+        
+        if (bind(listenSocket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            std::string error = std::system_category().message(errno);
+            close(listenSocket_);
+            listenSocket_ = -1;
+            throw std::runtime_error("Failed to listen on " + config_.socketPath + ": " + error);
+        }
+        
+        // Anyone who can connect can have the daemon read and write files as us, so the socket
+        // is owner-only whatever the umask says. Nobody can connect before listen, so there's no gap
+        if (chmod(config_.socketPath.c_str(), S_IRUSR | S_IWUSR) < 0 ||
+            listen(listenSocket_, SOMAXCONN) < 0) {
+            std::string error = std::system_category().message(errno);
+            closeSocket();  // The socket file is ours by now, so this removes it too
+            throw std::runtime_error("Failed to listen on " + config_.socketPath + ": " + error);
+        }
+    }
+
+    void CompressionDaemon::closeSocket() {
+        if (listenSocket_ >= 0) {
+            close(listenSocket_);
+            listenSocket_ = -1;
+            unlink(config_.socketPath.c_str());
+        }
+    }
+
+    void CompressionDaemon::workerLoop() {
+        // Lives as long as the worker, so the tables keep their memory between jobs
+        std::unique_ptr<ImageStatistics> statistics;
+        
+        while (true) {
+            std::unique_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex_);
+                jobAvailable_.wait(lock, [this] { return !queue_.empty() || !acceptingJobs_; });
+                if (queue_.empty()) return;  // Shutting down and nothing left to do
+                
+                job = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            spaceAvailable_.notify_one();
+            
+            JobResult result = processJob(*job, statistics);
+            if (result.success) {
+                jobsCompleted_++;
+            } else {
+                jobsFailed_++;
+            }
+            job->result.set_value(std::move(result));
+        }
+    }
+
+    CompressionDaemon::JobResult CompressionDaemon::processJob(const Job& job,
+                                                               std::unique_ptr<ImageStatistics>& statistics) {
+        JobResult result;
+        result.queueSeconds = secondsSince(job.queuedAt);
+        auto startTime = std::chrono::steady_clock::now();
+        
+        try {
+            Utils::PNG inputImage;
+            if (!inputImage.loadFromFile(job.inputPath)) {
+                throw std::runtime_error("Failed to load image from: " + job.inputPath);
+            }
+            
+            if (statistics) {
+                statistics->rebuild(inputImage);
+            } else {
+                statistics = std::make_unique<ImageStatistics>(inputImage);
+            }
+            
+            // Decoding and statistics have already eaten into the budget - the tree gets the rest
+            BuildConfig buildConfig;
+            if (config_.timeBudgetSeconds > 0.0) {
+                buildConfig.timeBudgetSeconds = std::max(config_.timeBudgetSeconds - secondsSince(startTime),
+                                                         std::numeric_limits<double>::min());
+            }
+            
+            CompressionResult compressed = ImageCompressor::compressStatistics(
+                *statistics, ImageCompressor::getConfigForQuality(job.qualityScore), buildConfig);
+            
+            if (!compressed.compressedImage.saveToFile(job.outputPath)) {
+                throw std::runtime_error("Failed to save compressed image to: " + job.outputPath);
+            }
+            
+            result.success = true;
+            result.compressionRatio = compressed.compressionRatio;
+            result.compressedRegions = compressed.compressedRegions;
+            result.originalPixels = compressed.originalPixels;
+            result.budgetExhausted = compressed.budgetExhausted;
+        } catch (const std::exception& e) {
+            result.error = e.what();
+        }
+        
+        result.processingSeconds = secondsSince(startTime);
+        return result;
+    }
+
+    std::future<CompressionDaemon::JobResult> CompressionDaemon::submitJob(std::unique_ptr<Job> job) {
+        std::future<JobResult> future = job->result.get_future();
+        {
+            std::unique_lock<std::mutex> lock(queueMutex_);
+            spaceAvailable_.wait(lock, [this] {
+                return queue_.size() < config_.queueCapacity || !acceptingJobs_;
+            });
+            if (!acceptingJobs_) return std::future<JobResult>();
+            
+            job->queuedAt = std::chrono::steady_clock::now();
+            queue_.push_back(std::move(job));
+        }
+        jobAvailable_.notify_one();
+        return future;
+    }
+
+    void CompressionDaemon::serveConnection(Connection& connection) {
+        // Replies go out from their own thread, so reading the next request never waits
+        // on the job before it
+        std::thread writer(&CompressionDaemon::sendReplies, this, std::ref(connection));
+        
+        std::string pending;
+        char buffer[4096];
+        bool open = true;
+        
+        while (open) {
+            ssize_t received = recv(connection.socket, buffer, sizeof(buffer), 0);
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) break;
+            pending.append(buffer, static_cast<size_t>(received));
+            
+            size_t lineEnd;
+            while (open && (lineEnd = pending.find('\n')) != std::string::npos) {
+                std::string line = pending.substr(0, lineEnd);
+                pending.erase(0, lineEnd + 1);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.empty()) continue;
+                
+                if (line == "QUIT") {
+                    open = false;
+                    break;
+                }
+                
+                // May wait for room in the job queue, which is what keeps a fast client in check
+                PendingReply reply = handleRequest(line);
+                {
+                    std::lock_guard<std::mutex> lock(connection.replyMutex);
+                    connection.replies.push_back(std::move(reply));
+                }
+                connection.replyQueued.notify_one();
+            }
+            
+            // Whatever's left has no newline yet - don't keep buffering for a client that never sends one
+            if (open && pending.size() > MAX_LINE_BYTES) {
+                {
+                    std::lock_guard<std::mutex> lock(connection.replyMutex);
+                    connection.replies.push_back({"ERR request line too long", {}});
+                }
+                connection.replyQueued.notify_one();
+                open = false;
+            }
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(connection.replyMutex);
+            connection.doneReading = true;
+        }
+        connection.replyQueued.notify_one();
+        writer.join();
+        connection.finished.store(true);
+    }
+
+    void CompressionDaemon::sendReplies(Connection& connection) {
+        bool connected = true;
+        while (true) {
+            PendingReply reply;
+            {
+                std::unique_lock<std::mutex> lock(connection.replyMutex);
+                connection.replyQueued.wait(lock, [&connection] {
+                    return !connection.replies.empty() || connection.doneReading;
+                });
+                if (connection.replies.empty()) return;   // Done reading and everything's been answered
+                
+                reply = std::move(connection.replies.front());
+                connection.replies.pop_front();
+            }
+            
+            // Once the client has gone its remaining jobs still run, but nobody hears about them
+            if (!connected) continue;
+            
+            std::string text = reply.result.valid() ? formatResult(reply.result.get()) : reply.text;
+            if (!sendAll(connection.socket, text + "\n")) {
+                // Stop the reader too - recv returns 0 after this
+                connected = false;
+                shutdown(connection.socket, SHUT_RD);
+            }
+        }
+    }
+
+    CompressionDaemon::PendingReply CompressionDaemon::handleRequest(const std::string& line) {
+        if (line == "PING") return {"PONG", {}};
+        
+        if (line == "STATS") {
+            size_t queued;
+            {
+                std::lock_guard<std::mutex> lock(queueMutex_);
+                queued = queue_.size();
+            }
+            std::ostringstream reply;
+            reply << "STATS " << jobsCompleted_.load() << " " << jobsFailed_.load() << " " << queued;
+            return {reply.str(), {}};
+        }
+        
+        std::vector<std::string> fields = splitFields(line);
+        if (fields.size() < 2 || fields.size() > 3) {
+            return {"ERR expected <input>\\t<output>[\\t<quality>]", {}};
+        }
+        
+        auto job = std::make_unique<Job>();
+        job->inputPath = fields[0];
+        job->outputPath = fields[1];
+        job->qualityScore = 0.5;
+        if (fields.size() == 3) {
+            try {
+                job->qualityScore = std::stod(fields[2]);
+            } catch (const std::exception&) {
+                return {"ERR invalid quality: " + fields[2], {}};
+            }
+            if (job->qualityScore < 0.0 || job->qualityScore > 1.0) {
+                return {"ERR quality out of range [0.0, 1.0]: " + fields[2], {}};
+            }
+        }
+        
+        std::future<JobResult> pendingResult = submitJob(std::move(job));
+        if (!pendingResult.valid()) return {"ERR daemon is shutting down", {}};
+        return {"", std::move(pendingResult)};
+    }
+
+    std::string CompressionDaemon::formatResult(const JobResult& result) {
+        if (!result.success) return "ERR " + result.error;
+        
+        std::ostringstream reply;
+        reply << "OK " << std::fixed << std::setprecision(6) << result.compressionRatio
+              << " " << result.compressedRegions << " " << result.originalPixels
+              << " " << result.queueSeconds << " " << result.processingSeconds
+              << " " << (result.budgetExhausted ? 1 : 0);
+        return reply.str();
+    }
+
+    void CompressionDaemon::reapFinishedConnections() {
+        for (auto it = connections_.begin(); it != connections_.end();) {
+            if ((*it)->finished.load()) {
+                (*it)->thread.join();
+                close((*it)->socket);
+                it = connections_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    bool CompressionDaemon::sendAll(int socket, const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            // MSG_NOSIGNAL - a client hanging up shouldn't kill the whole daemon with SIGPIPE
+            ssize_t written = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) return false;
+            sent += static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+} // namespace ImageCompression 
\ No newline at end of file
@@ -1,65 +1,175 @@
 #include "../../include/statistics/ImageStatistics.h"
+#include "../../include/utils/threading/TaskScheduler.h"
 #include <cmath>
 #include <algorithm>
 #include <cassert>
+#include <stdexcept>
+#include <string>
 
 namespace ImageCompression {
 
-    // Static member definitions
-    std::vector<double> ImageStatistics::cosLookup_;
-    std::vector<double> ImageStatistics::sinLookup_;
-    bool ImageStatistics::lookupTablesInitialized_ = false;
-
-    void ImageStatistics::initializeLookupTables() {
-        if (lookupTablesInitialized_) return;
+    namespace {
         
-        cosLookup_.resize(360);
-        sinLookup_.resize(360);
+        // Where buildCumulativeTables gets its pixels from
+        struct PNGPixelSource {
+            const Utils::PNG& image;
+            
+            const Utils::HSLAPixel& at(int x, int y) const {
+                return *image.getPixel(x, y);
+            }
+        };
         
+        // Converts caller-owned RGB bytes as they are read - no HSLA copy of the image is kept
+        struct ViewPixelSource {
+            const Utils::ImageView& view;
+            
+            Utils::HSLAPixel at(int x, int y) const {
+                Utils::HSLAColor color = Utils::rgbToHsla(view.getPixel(x, y));
+                return Utils::HSLAPixel(color.hue, color.saturation, color.luminance, color.alpha);
+            }
+        };
+        
+    } // namespace
+
+    ImageStatistics::TrigTables::TrigTables() {
         for (int i = 0; i < 360; ++i) {
             double radians = i * PI / 180.0;
-            cosLookup_[i] = std::cos(radians);
-            sinLookup_[i] = std::sin(radians);
+            cosine[i] = std::cos(radians);
+            sine[i] = std::sin(radians);
         }
-        
-        lookupTablesInitialized_ = true;
     }
 
     ImageStatistics::ImageStatistics(const Utils::PNG& image) 
-        : imageWidth_(image.getWidth()), imageHeight_(image.getHeight()) {
+        : imageWidth_(0), imageHeight_(0) {
         
-        // Initialize lookup tables once
-        initializeLookupTables();
+        rebuild(image);
+    }
+
+    ImageStatistics::ImageStatistics(const Utils::ImageView& view) 
+        : imageWidth_(0), imageHeight_(0) {
         
-        // Pre-allocate flat arrays
+        rebuild(view);
+    }
+
+    void ImageStatistics::rebuild(const Utils::PNG& image) {
+        resizeTables(image.getWidth(), image.getHeight());
+        buildCumulativeTables(PNGPixelSource{image}, 0, 0);
+    }
+
+    void ImageStatistics::rebuild(const Utils::ImageView& view) {
+        resizeTables(view.width, view.height);
+        buildCumulativeTables(ViewPixelSource{view}, 0, 0);
+    }
+
+    void ImageStatistics::resizeTables(int width, int height) {
+        imageWidth_ = width;
+        imageHeight_ = height;
+        
+        // Size the flat arrays - resize keeps their capacity, so an image no bigger
+        // than the last one doesn't allocate anything
         size_t totalPixels = static_cast<size_t>(imageWidth_) * imageHeight_;
         cumulativeHueX_.resize(totalPixels);
         cumulativeHueY_.resize(totalPixels);
         cumulativeSaturation_.resize(totalPixels);
         cumulativeLuminance_.resize(totalPixels);
-        cumulativeHueHistogram_.resize(totalPixels * HUE_BINS, 0);
+        cumulativeAlpha_.resize(totalPixels);
+        cumulativeHueHistogram_.resize(totalPixels * HISTOGRAM_BINS, 0);
+    }
+
+    void ImageStatistics::update(const Utils::PNG& image, const Rectangle& changedRegion) {
+        // The tables are rewritten in place from these, so anything off would write past them
+        if (static_cast<int>(image.getWidth()) != imageWidth_ || static_cast<int>(image.getHeight()) != imageHeight_) {
+            throw std::invalid_argument("Image is " + std::to_string(image.getWidth()) + "x" +
+                                        std::to_string(image.getHeight()) + ", statistics are " +
+                                        std::to_string(imageWidth_) + "x" + std::to_string(imageHeight_));
+        }
+        checkChangedRegion(changedRegion);
+        
+        // Everything above or left of the change still sums the same pixels
+        buildCumulativeTables(PNGPixelSource{image}, changedRegion.upperLeft.first, changedRegion.upperLeft.second);
+    }
+
+    void ImageStatistics::update(const Utils::PNG& image, const std::vector<Rectangle>& changedRegions) {
+        if (changedRegions.empty()) return;
+        
+        // One pass from the top-left-most corner covers every changed rectangle
+        int startX = imageWidth_;
+        int startY = imageHeight_;
+        for (const Rectangle& region : changedRegions) {
+            checkChangedRegion(region);
+            startX = std::min(startX, region.upperLeft.first);
+            startY = std::min(startY, region.upperLeft.second);
+        }
+        
+        update(image, Rectangle(startX, startY, imageWidth_ - 1, imageHeight_ - 1));
+    }
+
+    template <typename PixelSource>
+    void ImageStatistics::buildCumulativeTables(const PixelSource& pixels, int startX, int startY) {
+        int tilesX = (imageWidth_ - startX + TILE_WIDTH - 1) / TILE_WIDTH;
+        int tilesY = (imageHeight_ - startY + TILE_HEIGHT - 1) / TILE_HEIGHT;
+        if (tilesX <= 0 || tilesY <= 0) return;
+        
+        if (Utils::parallelism() <= 1 || (tilesX == 1 && tilesY == 1)) {
+            buildCumulativeTile(pixels, startX, startY, imageWidth_, imageHeight_);
+            return;
+        }
+        
+        // Each entry needs the ones above and to its left, so a tile only needs the tile
+        // above it and the tile to its left. Those are both on the previous diagonal, so we
+        // sweep diagonals from the top-left and do all the tiles on one diagonal at once.
+        // Every entry is still worked out exactly as in one serial pass.
+        for (int diagonal = 0; diagonal < tilesX + tilesY - 1; ++diagonal) {
+            int firstTileY = std::max(0, diagonal - (tilesX - 1));
+            int lastTileY = std::min(diagonal, tilesY - 1);
+            
+            Utils::parallelFor(firstTileY, lastTileY + 1, 1, [&](size_t begin, size_t end) {
+                for (size_t tileY = begin; tileY < end; ++tileY) {
+                    int tileX = diagonal - static_cast<int>(tileY);
+                    int tileStartX = startX + tileX * TILE_WIDTH;
+                    int tileStartY = startY + static_cast<int>(tileY) * TILE_HEIGHT;
+                    buildCumulativeTile(pixels, tileStartX, tileStartY,
+                                        std::min(tileStartX + TILE_WIDTH, imageWidth_),
+                                        std::min(tileStartY + TILE_HEIGHT, imageHeight_));
+                }
+            });
+        }
+    }
+
+    template <typename PixelSource>
+    void ImageStatistics::buildCumulativeTile(const PixelSource& pixels, int startX, int startY, int endX, int endY) {
+        const TrigTables& trig = trigTables();
         
         // Build cumulative arrays using flat indexing
-        for (int y = 0; y < imageHeight_; ++y) {
-            for (int x = 0; x < imageWidth_; ++x) {
+        for (int y = startY; y < endY; ++y) {
+            for (int x = startX; x < endX; ++x) {
                 size_t currentIndex = getIndex(x, y);
                 
                 // Get current pixel
-                const Utils::HSLAPixel* currentPixel = image.getPixel(x, y);
+                const auto& currentPixel = pixels.at(x, y);
+                
+                // Colour channels are weighted by alpha so transparent pixels
+                // don't drag a region's average towards their (meaningless) colour
+                double alpha = currentPixel.alpha;
                 
                 // Convert hue to cartesian coordinates using fast lookup
-                double currentHueX = currentPixel->saturation * fastCos(currentPixel->hue);
-                double currentHueY = currentPixel->saturation * fastSin(currentPixel->hue);
+                double currentHueX = alpha * currentPixel.saturation * fastCos(trig, currentPixel.hue);
+                double currentHueY = alpha * currentPixel.saturation * fastSin(trig, currentPixel.hue);
                 
                 // Calculate cumulative values
                 double cumulativeX = currentHueX;
                 double cumulativeY = currentHueY;
-                double cumulativeS = currentPixel->saturation;
-                double cumulativeL = currentPixel->luminance;
+                double cumulativeS = alpha * currentPixel.saturation;
+                double cumulativeL = alpha * currentPixel.luminance;
+                double cumulativeA = alpha;
                 
-                // Initialize histogram for current position
-                int hueBinIndex = static_cast<int>(currentPixel->hue / 10.0);
-                hueBinIndex = std::min(hueBinIndex, HUE_BINS - 1);
+                // Initialize histogram for current position - fully transparent
+                // pixels get their own bin so they don't count as any hue
+                int hueBinIndex = TRANSPARENT_BIN;
+                if (alpha > 0.0) {
+                    hueBinIndex = static_cast<int>(currentPixel.hue / 10.0);
+                    hueBinIndex = std::min(hueBinIndex, HUE_BINS - 1);
+                }
                 
                 // Add contributions from neighboring cumulative regions
                 if (x > 0 && y > 0) {
@@ -72,9 +182,10 @@ namespace ImageCompression {
                     cumulativeY += cumulativeHueY_[leftIndex] + cumulativeHueY_[topIndex] - cumulativeHueY_[topLeftIndex];
                     cumulativeS += cumulativeSaturation_[leftIndex] + cumulativeSaturation_[topIndex] - cumulativeSaturation_[topLeftIndex];
                     cumulativeL += cumulativeLuminance_[leftIndex] + cumulativeLuminance_[topIndex] - cumulativeLuminance_[topLeftIndex];
+                    cumulativeA += cumulativeAlpha_[leftIndex] + cumulativeAlpha_[topIndex] - cumulativeAlpha_[topLeftIndex];
                     
                     // Update histogram in-place (no vector copying!)
-                    for (int bin = 0; bin < HUE_BINS; ++bin) {
+                    for (int bin = 0; bin < HISTOGRAM_BINS; ++bin) {
                         size_t histIndex = getHistogramIndex(x, y, bin);
                         size_t leftHistIndex = getHistogramIndex(x-1, y, bin);
                         size_t topHistIndex = getHistogramIndex(x, y-1, bin);
@@ -93,8 +204,9 @@ namespace ImageCompression {
                     cumulativeY += cumulativeHueY_[leftIndex];
                     cumulativeS += cumulativeSaturation_[leftIndex];
                     cumulativeL += cumulativeLuminance_[leftIndex];
+                    cumulativeA += cumulativeAlpha_[leftIndex];
                     
-                    for (int bin = 0; bin < HUE_BINS; ++bin) {
+                    for (int bin = 0; bin < HISTOGRAM_BINS; ++bin) {
                         cumulativeHueHistogram_[getHistogramIndex(x, y, bin)] = 
                             cumulativeHueHistogram_[getHistogramIndex(x-1, y, bin)];
                     }
@@ -107,14 +219,19 @@ namespace ImageCompression {
                     cumulativeY += cumulativeHueY_[topIndex];
                     cumulativeS += cumulativeSaturation_[topIndex];
                     cumulativeL += cumulativeLuminance_[topIndex];
+                    cumulativeA += cumulativeAlpha_[topIndex];
                     
-                    for (int bin = 0; bin < HUE_BINS; ++bin) {
+                    for (int bin = 0; bin < HISTOGRAM_BINS; ++bin) {
                         cumulativeHueHistogram_[getHistogramIndex(x, y, bin)] = 
                             cumulativeHueHistogram_[getHistogramIndex(x, y-1, bin)];
                     }
                     cumulativeHueHistogram_[getHistogramIndex(x, y, hueBinIndex)]++;
                 } else {
                     // Top-left corner: just set the current pixel's histogram
+                    // (clear first - on an update the old pixel's bin is still set)
+                    for (int bin = 0; bin < HISTOGRAM_BINS; ++bin) {
+                        cumulativeHueHistogram_[getHistogramIndex(x, y, bin)] = 0;
+                    }
                     cumulativeHueHistogram_[getHistogramIndex(x, y, hueBinIndex)] = 1;
                 }
                 
@@ -123,15 +240,19 @@ namespace ImageCompression {
                 cumulativeHueY_[currentIndex] = cumulativeY;
                 cumulativeSaturation_[currentIndex] = cumulativeS;
                 cumulativeLuminance_[currentIndex] = cumulativeL;
+                cumulativeAlpha_[currentIndex] = cumulativeA;
             }
         }
     }
 
     Utils::HSLAPixel ImageStatistics::getAverageColor(const Rectangle& region) const {
+        return averageFromSums(getColorSums(region), getArea(region));
+    }
+
+    ColorSums ImageStatistics::getColorSums(const Rectangle& region) const {
         assert(isValidRectangle(region));
         
-        double totalHueX, totalHueY, totalSaturation, totalLuminance;
-        long pixelCount = getArea(region);
+        double totalHueX, totalHueY, totalSaturation, totalLuminance, totalAlpha;
         
         int ulX = region.upperLeft.first;
         int ulY = region.upperLeft.second;
@@ -145,6 +266,7 @@ namespace ImageCompression {
             totalHueY = cumulativeHueY_[lrIndex];
             totalSaturation = cumulativeSaturation_[lrIndex];
             totalLuminance = cumulativeLuminance_[lrIndex];
+            totalAlpha = cumulativeAlpha_[lrIndex];
         } else if (ulX == 0) {
             // Region on left edge
             size_t lrIndex = getIndex(lrX, lrY);
@@ -153,6 +275,7 @@ namespace ImageCompression {
             totalHueY = cumulativeHueY_[lrIndex] - cumulativeHueY_[topIndex];
             totalSaturation = cumulativeSaturation_[lrIndex] - cumulativeSaturation_[topIndex];
             totalLuminance = cumulativeLuminance_[lrIndex] - cumulativeLuminance_[topIndex];
+            totalAlpha = cumulativeAlpha_[lrIndex] - cumulativeAlpha_[topIndex];
         } else if (ulY == 0) {
             // Region on top edge
             size_t lrIndex = getIndex(lrX, lrY);
@@ -161,6 +284,7 @@ namespace ImageCompression {
             totalHueY = cumulativeHueY_[lrIndex] - cumulativeHueY_[leftIndex];
             totalSaturation = cumulativeSaturation_[lrIndex] - cumulativeSaturation_[leftIndex];
             totalLuminance = cumulativeLuminance_[lrIndex] - cumulativeLuminance_[leftIndex];
+            totalAlpha = cumulativeAlpha_[lrIndex] - cumulativeAlpha_[leftIndex];
         } else {
             // Interior region
             size_t lrIndex = getIndex(lrX, lrY);
@@ -176,19 +300,61 @@ namespace ImageCompression {
                              - cumulativeSaturation_[topIndex] + cumulativeSaturation_[topLeftIndex];
             totalLuminance = cumulativeLuminance_[lrIndex] - cumulativeLuminance_[leftIndex] 
                             - cumulativeLuminance_[topIndex] + cumulativeLuminance_[topLeftIndex];
+            totalAlpha = cumulativeAlpha_[lrIndex] - cumulativeAlpha_[leftIndex] 
+                        - cumulativeAlpha_[topIndex] + cumulativeAlpha_[topLeftIndex];
+        }
+        
+        ColorSums sums;
+        sums.hueX = totalHueX;
+        sums.hueY = totalHueY;
+        sums.saturation = totalSaturation;
+        sums.luminance = totalLuminance;
+        sums.alpha = totalAlpha;
+        return sums;
+    }
+
+    Utils::HSLAPixel ImageStatistics::averageFromSums(const ColorSums& sums, long pixelCount) {
+        // Nothing visible to average - keep it fully transparent
+        if (sums.isFullyTransparent()) {
+            return Utils::HSLAPixel(0.0, 0.0, 0.0, 0.0);
         }
         
-        // Calculate averages
-        double avgHueX = totalHueX / pixelCount;
-        double avgHueY = totalHueY / pixelCount;
-        double avgSaturation = totalSaturation / pixelCount;
-        double avgLuminance = totalLuminance / pixelCount;
+        // Colour sums are alpha-weighted, so normalise them by total alpha
+        double avgHueX = sums.hueX / sums.alpha;
+        double avgHueY = sums.hueY / sums.alpha;
+        double avgSaturation = sums.saturation / sums.alpha;
+        double avgLuminance = sums.luminance / sums.alpha;
+        double avgAlpha = std::min(1.0, sums.alpha / pixelCount);
         
         // Convert back to hue angle
         double avgHue = std::atan2(avgHueY, avgHueX) * 180.0 / PI;
         if (avgHue < 0) avgHue += 360.0; // Ensure positive angle
         
-        return Utils::HSLAPixel(avgHue, avgSaturation, avgLuminance, 1.0);
+        return Utils::HSLAPixel(avgHue, avgSaturation, avgLuminance, avgAlpha);
+    }
+
+    bool ImageStatistics::isFullyTransparent(const Rectangle& region) const {
+        assert(isValidRectangle(region));
+        
+        // Every pixel with zero alpha lands in the transparent bin, so a region is
+        // fully transparent exactly when that bin's count covers the whole region
+        int ulX = region.upperLeft.first;
+        int ulY = region.upperLeft.second;
+        int lrX = region.lowerRight.first;
+        int lrY = region.lowerRight.second;
+        
+        long transparentCount = cumulativeHueHistogram_[getHistogramIndex(lrX, lrY, TRANSPARENT_BIN)];
+        if (ulX > 0) {
+            transparentCount -= cumulativeHueHistogram_[getHistogramIndex(ulX-1, lrY, TRANSPARENT_BIN)];
+        }
+        if (ulY > 0) {
+            transparentCount -= cumulativeHueHistogram_[getHistogramIndex(lrX, ulY-1, TRANSPARENT_BIN)];
+        }
+        if (ulX > 0 && ulY > 0) {
+            transparentCount += cumulativeHueHistogram_[getHistogramIndex(ulX-1, ulY-1, TRANSPARENT_BIN)];
+        }
+        
+        return transparentCount == getArea(region);
     }
 
     long ImageStatistics::getArea(const Rectangle& region) const {
@@ -200,9 +366,10 @@ namespace ImageCompression {
     }
 
     double ImageStatistics::calculateEntropy(const Rectangle& region) const {
-        std::vector<int> histogram = buildHueHistogram(region);
-        long area = getArea(region);
-        return calculateEntropyFromDistribution(histogram, area);
+        // Stack histogram - this runs several times per tree node, so no heap allocation
+        int histogram[HISTOGRAM_BINS];
+        fillHueHistogram(region, histogram);
+        return calculateEntropyFromCounts(histogram, HISTOGRAM_BINS, getArea(region));
     }
 
     double ImageStatistics::calculateEntropyOptimized(const Rectangle& region, std::vector<int>& histogramBuffer) const {
@@ -212,6 +379,20 @@ namespace ImageCompression {
     }
 
     std::vector<int> ImageStatistics::buildHueHistogram(const Rectangle& region) const {
+        std::vector<int> histogram(HISTOGRAM_BINS);
+        fillHueHistogram(region, histogram.data());
+        return histogram;
+    }
+
+    void ImageStatistics::buildHueHistogramOptimized(const Rectangle& region, std::vector<int>& histogramBuffer) const {
+        // Ensure buffer is the right size - every bin gets overwritten
+        if (histogramBuffer.size() != HISTOGRAM_BINS) {
+            histogramBuffer.resize(HISTOGRAM_BINS);
+        }
+        fillHueHistogram(region, histogramBuffer.data());
+    }
+
+    void ImageStatistics::fillHueHistogram(const Rectangle& region, int* histogram) const {
         assert(isValidRectangle(region));
         
         int ulX = region.upperLeft.first;
@@ -219,78 +400,32 @@ namespace ImageCompression {
         int lrX = region.lowerRight.first;
         int lrY = region.lowerRight.second;
         
-        std::vector<int> histogram(HUE_BINS, 0);
-        
         if (ulX == 0 && ulY == 0) {
             // Region starts at origin
-            for (int bin = 0; bin < HUE_BINS; ++bin) {
+            for (int bin = 0; bin < HISTOGRAM_BINS; ++bin) {
                 histogram[bin] = cumulativeHueHistogram_[getHistogramIndex(lrX, lrY, bin)];
             }
         } else if (ulX == 0) {
             // Region on left edge
-            for (int bin = 0; bin < HUE_BINS; ++bin) {
+            for (int bin = 0; bin < HISTOGRAM_BINS; ++bin) {
                 histogram[bin] = cumulativeHueHistogram_[getHistogramIndex(lrX, lrY, bin)] 
                                - cumulativeHueHistogram_[getHistogramIndex(lrX, ulY-1, bin)];
             }
         } else if (ulY == 0) {
             // Region on top edge
-            for (int bin = 0; bin < HUE_BINS; ++bin) {
+            for (int bin = 0; bin < HISTOGRAM_BINS; ++bin) {
                 histogram[bin] = cumulativeHueHistogram_[getHistogramIndex(lrX, lrY, bin)] 
                                - cumulativeHueHistogram_[getHistogramIndex(ulX-1, lrY, bin)];
             }
         } else {
             // Interior region
-            for (int bin = 0; bin < HUE_BINS; ++bin) {
+            for (int bin = 0; bin < HISTOGRAM_BINS; ++bin) {
                 histogram[bin] = cumulativeHueHistogram_[getHistogramIndex(lrX, lrY, bin)]
                                - cumulativeHueHistogram_[getHistogramIndex(ulX-1, lrY, bin)]
                                - cumulativeHueHistogram_[getHistogramIndex(lrX, ulY-1, bin)]
                                + cumulativeHueHistogram_[getHistogramIndex(ulX-1, ulY-1, bin)];
             }
         }
-        
-        return histogram;
-    }
-
-    void ImageStatistics::buildHueHistogramOptimized(const Rectangle& region, std::vector<int>& histogramBuffer) const {
-        assert(isValidRectangle(region));
-        
-        // Ensure buffer is the right size and clear it
-        if (histogramBuffer.size() != HUE_BINS) {
-            histogramBuffer.resize(HUE_BINS);
-        }
-        std::fill(histogramBuffer.begin(), histogramBuffer.end(), 0);
-        
-        int ulX = region.upperLeft.first;
-        int ulY = region.upperLeft.second;
-        int lrX = region.lowerRight.first;
-        int lrY = region.lowerRight.second;
-        
-        if (ulX == 0 && ulY == 0) {
-            // Region starts at origin
-            for (int bin = 0; bin < HUE_BINS; ++bin) {
-                histogramBuffer[bin] = cumulativeHueHistogram_[getHistogramIndex(lrX, lrY, bin)];
-            }
-        } else if (ulX == 0) {
-            // Region on left edge
-            for (int bin = 0; bin < HUE_BINS; ++bin) {
-                histogramBuffer[bin] = cumulativeHueHistogram_[getHistogramIndex(lrX, lrY, bin)] 
-                                     - cumulativeHueHistogram_[getHistogramIndex(lrX, ulY-1, bin)];
-            }
-        } else if (ulY == 0) {
-            // Region on top edge
-            for (int bin = 0; bin < HUE_BINS; ++bin) {
-                histogramBuffer[bin] = cumulativeHueHistogram_[getHistogramIndex(lrX, lrY, bin)] 
-                                     - cumulativeHueHistogram_[getHistogramIndex(ulX-1, lrY, bin)];
-            }
-        } else {
-            // Interior region
-            for (int bin = 0; bin < HUE_BINS; ++bin) {
-                histogramBuffer[bin] = cumulativeHueHistogram_[getHistogramIndex(lrX, lrY, bin)]
-                                     - cumulativeHueHistogram_[getHistogramIndex(ulX-1, lrY, bin)]
-                                     - cumulativeHueHistogram_[getHistogramIndex(lrX, ulY-1, bin)]
-                                     + cumulativeHueHistogram_[getHistogramIndex(ulX-1, ulY-1, bin)];
-            }
-        }
     }
 
     std::vector<int> ImageStatistics::subtractHistograms(const std::vector<int>& first, 
@@ -319,13 +454,17 @@ namespace ImageCompression {
 
     double ImageStatistics::calculateEntropyFromDistribution(const std::vector<int>& distribution, 
                                                            int totalArea) const {
+        return calculateEntropyFromCounts(distribution.data(), distribution.size(), totalArea);
+    }
+
+    double ImageStatistics::calculateEntropyFromCounts(const int* counts, size_t binCount, long totalArea) {
         if (totalArea <= 0) return 0.0;
         
         double entropy = 0.0;
         
-        for (int count : distribution) {
-            if (count > 0) {
-                double probability = static_cast<double>(count) / totalArea;
+        for (size_t bin = 0; bin < binCount; ++bin) {
+            if (counts[bin] > 0) {
+                double probability = static_cast<double>(counts[bin]) / totalArea;
                 entropy -= probability * std::log2(probability);
             }
         }
@@ -333,6 +472,16 @@ namespace ImageCompression {
         return entropy;
     }
 
+    void ImageStatistics::checkChangedRegion(const Rectangle& region) const {
+        if (!isValidRectangle(region)) {
+            throw std::invalid_argument("Changed region (" + std::to_string(region.upperLeft.first) + "," +
+                                        std::to_string(region.upperLeft.second) + ")-(" +
+                                        std::to_string(region.lowerRight.first) + "," +
+                                        std::to_string(region.lowerRight.second) + ") is outside the " +
+                                        std::to_string(imageWidth_) + "x" + std::to_string(imageHeight_) + " image");
+        }
+    }
+
     bool ImageStatistics::isValidRectangle(const Rectangle& region) const {
         return region.upperLeft.first >= 0 && region.upperLeft.second >= 0 &&
                region.lowerRight.first < imageWidth_ && region.lowerRight.second < imageHeight_ &&
@@ -0,0 +1,84 @@
+#include "../../include/statistics/SquaredErrorTable.h"
+#include <cmath>
+#include <limits>
+
+namespace ImageCompression {
+
+    SquaredErrorTable::SquaredErrorTable(const Utils::PNG& image)
+        : imageWidth_(static_cast<int>(image.getWidth())), imageHeight_(static_cast<int>(image.getHeight())) {
+        
+        cumulative_.resize(static_cast<size_t>(imageWidth_) * imageHeight_);
+        
+        // Running row totals plus the finished row above - unsigned wraparound is fine,
+        // the four-corner lookups only ever take differences
+        for (int y = 0; y < imageHeight_; ++y) {
+            ChannelSums row = {};
+            for (int x = 0; x < imageWidth_; ++x) {
+                const Utils::HSLAPixel& pixel = *image.getPixel(x, y);
+                Utils::RGBColor rgb = Utils::hslaToRgb(Utils::HSLAColor(pixel.hue, pixel.saturation,
+                                                                        pixel.luminance, pixel.alpha));
+                uint64_t channels[3] = {rgb.red, rgb.green, rgb.blue};
+                
+                ChannelSums& cell = cumulative_[getIndex(x, y)];
+                for (int c = 0; c < 3; ++c) {
+                    row.sum[c] += channels[c];
+                    row.squares[c] += channels[c] * channels[c];
+                    cell.sum[c] = row.sum[c];
+                    cell.squares[c] = row.squares[c];
+                }
+                
+                if (y > 0) {
+                    const ChannelSums& above = cumulative_[getIndex(x, y - 1)];
+                    for (int c = 0; c < 3; ++c) {
+                        cell.sum[c] += above.sum[c];
+                        cell.squares[c] += above.squares[c];
+                    }
+                }
+            }
+        }
+    }
+
+    double SquaredErrorTable::squaredError(const Rectangle& region, const Utils::RGBColor& color) const {
+        int left = region.upperLeft.first;
+        int top = region.upperLeft.second;
+        int right = region.lowerRight.first;
+        int bottom = region.lowerRight.second;
+        
+        ChannelSums total = cumulative_[getIndex(right, bottom)];
+        auto subtract = [&](const ChannelSums& other) {
+            for (int c = 0; c < 3; ++c) {
+                total.sum[c] -= other.sum[c];
+                total.squares[c] -= other.squares[c];
+            }
+        };
+        auto add = [&](const ChannelSums& other) {
+            for (int c = 0; c < 3; ++c) {
+                total.sum[c] += other.sum[c];
+                total.squares[c] += other.squares[c];
+            }
+        };
+        if (left > 0) subtract(cumulative_[getIndex(left - 1, bottom)]);
+        if (top > 0) subtract(cumulative_[getIndex(right, top - 1)]);
+        if (left > 0 && top > 0) add(cumulative_[getIndex(left - 1, top - 1)]);
+        
+        // Painted values are 8-bit, so this stays exact until it's turned into a double
+        int64_t area = static_cast<int64_t>(right - left + 1) * (bottom - top + 1);
+        int64_t painted[3] = {color.red, color.green, color.blue};
+        int64_t error = 0;
+        for (int c = 0; c < 3; ++c) {
+            error += static_cast<int64_t>(total.squares[c]) - 2 * painted[c] * static_cast<int64_t>(total.sum[c]) +
+                     area * painted[c] * painted[c];
+        }
+        return static_cast<double>(error);
+    }
+
+    double SquaredErrorTable::psnr(double totalSquaredError) const {
+        double samples = 3.0 * imageWidth_ * imageHeight_;
+        if (totalSquaredError <= 0.0 || samples == 0.0) {
+            return std::numeric_limits<double>::infinity();
+        }
+        double meanSquaredError = totalSquaredError / samples;
+        return 10.0 * std::log10(255.0 * 255.0 / meanSquaredError);
+    }
+
+} // namespace ImageCompression 
\ No newline at end of file
@@ -0,0 +1,154 @@
+/**
+ * @file FastHash.cpp
+ * @brief XXH64 implementation
+ *
+ * Follows the reference algorithm exactly, reading input as little-endian
+ * on every platform so digests are portable.
+ */
+
+#include "../../../include/utils/hash/FastHash.h"
+#include <cstring>
+
+namespace ImageCompression {
+namespace Utils {
+
+namespace {
+    constexpr uint64_t PRIME1 = 11400714785074694791ULL;
+    constexpr uint64_t PRIME2 = 14029467366897019727ULL;
+    constexpr uint64_t PRIME3 = 1609587929392839161ULL;
+    constexpr uint64_t PRIME4 = 9650029242287828579ULL;
+    constexpr uint64_t PRIME5 = 2870177450012600261ULL;
+
+    inline uint64_t rotateLeft(uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    inline uint64_t read64(const unsigned char* bytes) {
+        uint64_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        value = __builtin_bswap64(value);
+#endif
+        return value;
+    }
+
+    inline uint32_t read32(const unsigned char* bytes) {
+        uint32_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        value = __builtin_bswap32(value);
+#endif
+        return value;
+    }
+
+    inline uint64_t round(uint64_t accumulator, uint64_t input) {
+        accumulator += input * PRIME2;
+        accumulator = rotateLeft(accumulator, 31);
+        return accumulator * PRIME1;
+    }
+
+    inline uint64_t mergeRound(uint64_t accumulator, uint64_t lane) {
+        accumulator ^= round(0, lane);
+        return accumulator * PRIME1 + PRIME4;
+    }
+
+    // Consume whole 32-byte stripes, one 8-byte word per lane
+    inline const unsigned char* consumeStripes(uint64_t lanes[4], const unsigned char* bytes,
+                                               const unsigned char* end) {
+        uint64_t lane0 = lanes[0], lane1 = lanes[1], lane2 = lanes[2], lane3 = lanes[3];
+        while (bytes + 32 <= end) {
+            lane0 = round(lane0, read64(bytes));
+            lane1 = round(lane1, read64(bytes + 8));
+            lane2 = round(lane2, read64(bytes + 16));
+            lane3 = round(lane3, read64(bytes + 24));
+            bytes += 32;
+        }
+        lanes[0] = lane0; lanes[1] = lane1; lanes[2] = lane2; lanes[3] = lane3;
+        return bytes;
+    }
+}
+
+FastHash::FastHash(uint64_t seed)
+    : seed_(seed), totalLength_(0), bufferSize_(0) {
+    lanes_[0] = seed + PRIME1 + PRIME2;
+    lanes_[1] = seed + PRIME2;
+    lanes_[2] = seed;
+    lanes_[3] = seed - PRIME1;
+}
+
+void FastHash::update(const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    const unsigned char* end = bytes + size;
+    totalLength_ += size;
+
+    // Top up a partial stripe from last time first
+    if (bufferSize_ > 0) {
+        size_t needed = 32 - bufferSize_;
+        if (size < needed) {
+            std::memcpy(buffer_ + bufferSize_, bytes, size);
+            bufferSize_ += size;
+            return;
+        }
+        std::memcpy(buffer_ + bufferSize_, bytes, needed);
+        consumeStripes(lanes_, buffer_, buffer_ + 32);
+        bytes += needed;
+        bufferSize_ = 0;
+    }
+
+    bytes = consumeStripes(lanes_, bytes, end);
+
+    // Keep the tail for the next update or the digest
+    bufferSize_ = static_cast<size_t>(end - bytes);
+    std::memcpy(buffer_, bytes, bufferSize_);
+}
+
+uint64_t FastHash::digest() const {
+    uint64_t hash;
+    if (totalLength_ >= 32) {
+        hash = rotateLeft(lanes_[0], 1) + rotateLeft(lanes_[1], 7) +
+               rotateLeft(lanes_[2], 12) + rotateLeft(lanes_[3], 18);
+        hash = mergeRound(hash, lanes_[0]);
+        hash = mergeRound(hash, lanes_[1]);
+        hash = mergeRound(hash, lanes_[2]);
+        hash = mergeRound(hash, lanes_[3]);
+    } else {
+        hash = seed_ + PRIME5;
+    }
+    hash += totalLength_;
+
+    // Mix in whatever didn't fill a stripe
+    const unsigned char* bytes = buffer_;
+    const unsigned char* end = buffer_ + bufferSize_;
+    while (bytes + 8 <= end) {
+        hash ^= round(0, read64(bytes));
+        hash = rotateLeft(hash, 27) * PRIME1 + PRIME4;
+        bytes += 8;
+    }
+    if (bytes + 4 <= end) {
+        hash ^= static_cast<uint64_t>(read32(bytes)) * PRIME1;
+        hash = rotateLeft(hash, 23) * PRIME2 + PRIME3;
+        bytes += 4;
+    }
+    while (bytes < end) {
+        hash ^= (*bytes) * PRIME5;
+        hash = rotateLeft(hash, 11) * PRIME1;
+        ++bytes;
+    }
+
+    // Final avalanche so every input bit affects every output bit
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t FastHash::hash(const void* data, size_t size, uint64_t seed) {
+    FastHash hasher(seed);
+    hasher.update(data, size);
+    return hasher.digest();
+}
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file
@@ -8,14 +8,41 @@
 
 #include "../../../include/utils/image/PNG.h"
 #include "../../../include/utils/image/ColorConversion.h"
+#include "../../../include/utils/hash/FastHash.h"
+#include "../../../include/utils/memory/AlignedAllocator.h"
 #include "../external/lodepng/lodepng.h"
 #include <iostream>
 #include <stdexcept>
-#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <type_traits>
 
 namespace ImageCompression {
 namespace Utils {
 
+static_assert(std::is_trivially_destructible<HSLAPixel>::value,
+              "allocatePixels frees pixel memory without running destructors");
+
+namespace {
+    // Pixels converted to RGBA8 at a time when hashing or comparing - small
+    // enough to live on the stack, big enough to keep the loops tight
+    constexpr size_t CHUNK_PIXELS = 1024;
+    
+    // Pixels come from the aligned allocator, so big images get huge pages
+    std::shared_ptr<HSLAPixel[]> allocatePixels(size_t pixelCount) {
+        size_t bytes = pixelCount * sizeof(HSLAPixel);
+        HSLAPixel* pixels = static_cast<HSLAPixel*>(allocateAligned(bytes));
+        std::uninitialized_default_construct_n(pixels, pixelCount);
+        recordAllocation(MemoryOwner::PngPixels, bytes);
+        return std::shared_ptr<HSLAPixel[]>(pixels, [bytes](HSLAPixel* block) {
+            recordRelease(MemoryOwner::PngPixels, bytes);
+            deallocateAligned(block, bytes);   // HSLAPixel is trivially destructible
+        });
+    }
+}
+
 PNG::PNG() : width_(0), height_(0), imageData_(nullptr) {
 }
 
@@ -26,11 +53,11 @@ PNG::PNG(unsigned int width, unsigned int height)
     }
     
     size_t pixelCount = static_cast<size_t>(width_) * height_;
-    imageData_ = std::make_unique<HSLAPixel[]>(pixelCount);
+    imageData_ = allocatePixels(pixelCount);
 }
 
-PNG::PNG(const PNG& other) : width_(other.width_), height_(other.height_) {
-    copyFrom(other);
+PNG::PNG(const PNG& other) 
+    : width_(other.width_), height_(other.height_), imageData_(other.imageData_) {
 }
 
 PNG::PNG(PNG&& other) noexcept 
@@ -45,7 +72,7 @@ PNG& PNG::operator=(const PNG& other) {
     if (this != &other) {
         width_ = other.width_;
         height_ = other.height_;
-        copyFrom(other);
+        imageData_ = other.imageData_;
     }
     return *this;
 }
@@ -63,22 +90,7 @@ PNG& PNG::operator=(PNG&& other) noexcept {
 }
 
 bool PNG::operator==(const PNG& other) const {
-    if (width_ != other.width_ || height_ != other.height_) {
-        return false;
-    }
-    
-    if (isEmpty() && other.isEmpty()) {
-        return true;
-    }
-    
-    size_t pixelCount = getPixelCount();
-    for (size_t i = 0; i < pixelCount; ++i) {
-        if (imageData_[i] != other.imageData_[i]) {
-            return false;
-        }
-    }
-    
-    return true;
+    return equalsExact(other);
 }
 
 bool PNG::operator!=(const PNG& other) const {
@@ -95,11 +107,67 @@ bool PNG::loadFromFile(const std::string& filename) {
                                ": " + lodepng_error_text(error));
     }
     
+    // The decoded bytes and the new pixels are both alive while converting
+    ScopedMemoryCharge decodedCharge(MemoryOwner::CodecBuffers, byteData.size());
+    setFromRGBA(byteData, width, height);
+    return true;
+}
+
+bool PNG::loadFromMemory(const unsigned char* data, size_t size) {
+    std::vector<unsigned char> byteData;
+    unsigned int width, height;
+    
+    unsigned error = lodepng::decode(byteData, width, height, data, size);
+    if (error) {
+        throw std::runtime_error("PNG decode error " + std::to_string(error) + 
+                               ": " + lodepng_error_text(error));
+    }
+    
+    // The decoded bytes and the new pixels are both alive while converting
+    ScopedMemoryCharge decodedCharge(MemoryOwner::CodecBuffers, byteData.size());
+    setFromRGBA(byteData, width, height);
+    return true;
+}
+
+bool PNG::saveToFile(const std::string& filename) {
+    std::vector<unsigned char> byteData;
+    toRGBA(byteData);
+    ScopedMemoryCharge rgbaCharge(MemoryOwner::CodecBuffers, byteData.size());
+    
+    unsigned error = lodepng::encode(filename, byteData, width_, height_);
+    if (error) {
+        throw std::runtime_error("PNG encode error " + std::to_string(error) + 
+                               ": " + lodepng_error_text(error));
+    }
+    
+    return true;
+}
+
+bool PNG::saveToMemory(std::vector<unsigned char>& encoded) const {
+    std::vector<unsigned char> byteData;
+    toRGBA(byteData);
+    ScopedMemoryCharge rgbaCharge(MemoryOwner::CodecBuffers, byteData.size());
+    
+    // lodepng appends to the output vector
+    encoded.clear();
+    unsigned error = lodepng::encode(encoded, byteData, width_, height_);
+    if (error) {
+        throw std::runtime_error("PNG encode error " + std::to_string(error) + 
+                               ": " + lodepng_error_text(error));
+    }
+    
+    // Counted once it exists, alongside the RGBA bytes it was made from
+    ScopedMemoryCharge encodedCharge(MemoryOwner::CodecBuffers, encoded.size());
+    
+    return true;
+}
+
+void PNG::setFromRGBA(const std::vector<unsigned char>& byteData, unsigned int width, unsigned int height) {
     // Update dimensions and allocate new data
     width_ = width;
     height_ = height;
     size_t pixelCount = getPixelCount();
-    imageData_ = std::make_unique<HSLAPixel[]>(pixelCount);
+    imageData_ = allocatePixels(pixelCount);
     
     // Convert RGB byte data to HSLA pixels
     for (size_t i = 0; i < byteData.size(); i += 4) {
@@ -112,37 +180,29 @@ bool PNG::loadFromFile(const std::string& filename) {
         pixel.luminance = hsla.luminance;
         pixel.alpha = hsla.alpha;
     }
-    
-    return true;
 }
 
-bool PNG::saveToFile(const std::string& filename) {
+void PNG::toRGBA(std::vector<unsigned char>& byteData) const {
     if (isEmpty()) {
         throw std::runtime_error("Cannot save empty PNG image");
     }
     
     size_t pixelCount = getPixelCount();
-    auto byteData = std::make_unique<unsigned char[]>(pixelCount * 4);
-    
+    byteData.resize(pixelCount * 4);
+    toRGBA(0, pixelCount, byteData.data());
+}
+
+void PNG::toRGBA(size_t start, size_t count, unsigned char* byteData) const {
     // Convert HSLA pixels to RGB byte data
-    for (size_t i = 0; i < pixelCount; ++i) {
-        HSLAColor hsla(imageData_[i].hue, imageData_[i].saturation, 
-                      imageData_[i].luminance, imageData_[i].alpha);
-        RGBColor rgb = hslaToRgb(hsla);
+    for (size_t i = 0; i < count; ++i) {
+        const HSLAPixel& pixel = imageData_[start + i];
+        RGBColor rgb = hslaToRgb(HSLAColor(pixel.hue, pixel.saturation, pixel.luminance, pixel.alpha));
         
         byteData[i * 4] = rgb.red;
         byteData[i * 4 + 1] = rgb.green;
         byteData[i * 4 + 2] = rgb.blue;
         byteData[i * 4 + 3] = rgb.alpha;
     }
-    
-    unsigned error = lodepng::encode(filename, byteData.get(), width_, height_);
-    if (error) {
-        throw std::runtime_error("PNG encode error " + std::to_string(error) + 
-                               ": " + lodepng_error_text(error));
-    }
-    
-    return true;
 }
 
 HSLAPixel* PNG::getPixel(unsigned int x, unsigned int y) {
@@ -150,10 +210,20 @@ HSLAPixel* PNG::getPixel(unsigned int x, unsigned int y) {
         return nullptr;
     }
     
+    detach();
     size_t index = x + (static_cast<size_t>(y) * width_);
     return &imageData_[index];
 }
 
+HSLAPixel* PNG::getPixelData() {
+    if (isEmpty()) {
+        return nullptr;
+    }
+    
+    detach();
+    return imageData_.get();
+}
+
 const HSLAPixel* PNG::getPixel(unsigned int x, unsigned int y) const {
     if (!isValidCoordinate(x, y)) {
         return nullptr;
@@ -169,20 +239,16 @@ void PNG::resize(unsigned int newWidth, unsigned int newHeight) {
     }
     
     size_t newPixelCount = static_cast<size_t>(newWidth) * newHeight;
-    auto newImageData = std::make_unique<HSLAPixel[]>(newPixelCount);
+    auto newImageData = allocatePixels(newPixelCount);
     
-    // Copy existing pixel data where it fits
-    unsigned int minWidth = std::min(width_, newWidth);
-    unsigned int minHeight = std::min(height_, newHeight);
+    // Copy existing pixel data where it fits - always into a new buffer, so
+    // any other images sharing the old one are left alone
+    unsigned int minWidth = isEmpty() ? 0 : std::min(width_, newWidth);
+    unsigned int minHeight = isEmpty() ? 0 : std::min(height_, newHeight);
     
     for (unsigned int y = 0; y < minHeight; ++y) {
-        for (unsigned int x = 0; x < minWidth; ++x) {
-            const HSLAPixel* oldPixel = getPixel(x, y);
-            if (oldPixel) {
-                size_t newIndex = x + (static_cast<size_t>(y) * newWidth);
-                newImageData[newIndex] = *oldPixel;
-            }
-        }
+        const HSLAPixel* oldRow = &imageData_[static_cast<size_t>(y) * width_];
+        std::copy(oldRow, oldRow + minWidth, &newImageData[static_cast<size_t>(y) * newWidth]);
     }
     
     // Update image properties
@@ -191,24 +257,77 @@ void PNG::resize(unsigned int newWidth, unsigned int newHeight) {
     imageData_ = std::move(newImageData);
 }
 
-std::size_t PNG::computeHash() const {
+bool PNG::equalsExact(const PNG& other) const {
+    return equalsWithin(other, 0);
+}
+
+bool PNG::equalsWithin(const PNG& other, unsigned int maxChannelDifference) const {
+    if (width_ != other.width_ || height_ != other.height_) {
+        return false;
+    }
+    
+    if (isEmpty() || imageData_ == other.imageData_) {
+        return true;
+    }
+    
+    // Bitwise-identical pixels always convert to the same bytes, which covers
+    // copies without converting anything
+    size_t pixelCount = getPixelCount();
+    if (std::memcmp(imageData_.get(), other.imageData_.get(), pixelCount * sizeof(HSLAPixel)) == 0) {
+        return true;
+    }
+    
+    unsigned char ours[CHUNK_PIXELS * 4];
+    unsigned char theirs[CHUNK_PIXELS * 4];
+    for (size_t start = 0; start < pixelCount; start += CHUNK_PIXELS) {
+        size_t count = std::min(CHUNK_PIXELS, pixelCount - start);
+        size_t byteCount = count * 4;
+        toRGBA(start, count, ours);
+        other.toRGBA(start, count, theirs);
+        
+        if (maxChannelDifference == 0) {
+            if (std::memcmp(ours, theirs, byteCount) != 0) {
+                return false;
+            }
+            continue;
+        }
+        
+        // No branches in here, so this becomes packed byte max/min on SIMD targets
+        unsigned char largest = 0;
+        for (size_t i = 0; i < byteCount; ++i) {
+            unsigned char difference = ours[i] > theirs[i] ? ours[i] - theirs[i] : theirs[i] - ours[i];
+            largest = std::max(largest, difference);
+        }
+        if (largest > maxChannelDifference) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+uint64_t PNG::computeHash() const {
     if (isEmpty()) {
         return 0;
     }
     
-    std::hash<double> hasher;
-    std::size_t hash = 0;
-    size_t pixelCount = getPixelCount();
+    // Hash the 8-bit RGBA bytes the image would be saved as, converted a chunk at
+    // a time so we never hold a second copy of the whole image
+    unsigned char chunk[CHUNK_PIXELS * 4];
+    FastHash hasher;
     
-    for (size_t i = 0; i < pixelCount; ++i) {
-        const HSLAPixel& pixel = imageData_[i];
-        hash ^= hasher(pixel.hue) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
-        hash ^= hasher(pixel.saturation) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
-        hash ^= hasher(pixel.luminance) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
-        hash ^= hasher(pixel.alpha) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    // Dimensions go in first so a 2x8 and a 4x4 image with the same bytes differ
+    uint32_t dimensions[2] = {width_, height_};
+    hasher.update(dimensions, sizeof(dimensions));
+    
+    size_t pixelCount = getPixelCount();
+    for (size_t start = 0; start < pixelCount; start += CHUNK_PIXELS) {
+        size_t count = std::min(CHUNK_PIXELS, pixelCount - start);
+        toRGBA(start, count, chunk);
+        hasher.update(chunk, count * 4);
     }
     
-    return hash;
+    return hasher.digest();
 }
 
 void PNG::normalizeColors() {
@@ -216,6 +335,7 @@ void PNG::normalizeColors() {
         return;
     }
     
+    detach();
     size_t pixelCount = getPixelCount();
     for (size_t i = 0; i < pixelCount; ++i) {
         HSLAPixel& pixel = imageData_[i];
@@ -229,18 +349,23 @@ void PNG::normalizeColors() {
     }
 }
 
-void PNG::copyFrom(const PNG& other) {
-    if (other.isEmpty()) {
-        imageData_.reset();
+void PNG::detach() {
+    if (!imageData_) {
         return;
     }
     
-    size_t pixelCount = other.getPixelCount();
-    imageData_ = std::make_unique<HSLAPixel[]>(pixelCount);
-    
-    for (size_t i = 0; i < pixelCount; ++i) {
-        imageData_[i] = other.imageData_[i];
+    // use_count() == 1 means nobody else can be looking at these pixels. The count is
+    // read relaxed, so the fence orders our writes after another thread's last reads
+    // of the buffer, made before it dropped its copy
+    if (imageData_.use_count() == 1) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return;
     }
+    
+    size_t pixelCount = getPixelCount();
+    auto ownData = allocatePixels(pixelCount);
+    std::copy(imageData_.get(), imageData_.get() + pixelCount, ownData.get());
+    imageData_ = std::move(ownData);
 }
 
 bool PNG::isValidCoordinate(unsigned int x, unsigned int y) const {
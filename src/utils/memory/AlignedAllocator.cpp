@@ -0,0 +1,160 @@
+/**
+ * @file AlignedAllocator.cpp
+ * @brief Aligned and huge-page backed allocation
+ *
+ * Small blocks come from aligned_alloc. Large ones are mmap'd with room to
+ * spare and trimmed to a 2 MB boundary, since transparent huge pages can
+ * only back 2 MB aligned ranges.
+ */
+
+#include "../../../include/utils/memory/AlignedAllocator.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace ImageCompression {
+namespace Utils {
+
+namespace {
+    std::mutex policyMutex;
+    LargeAllocationPolicy currentPolicy;
+
+    size_t roundUp(size_t value, size_t multiple) {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    void* mapExplicitHugePages(size_t bytes) {
+#ifdef MAP_HUGETLB
+        void* block = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        return block == MAP_FAILED ? nullptr : block;
+#else
+        (void)bytes;
+        return nullptr;
+#endif
+    }
+
+    // Map bytes + one huge page, then hand the unaligned ends back
+    void* mapAligned(size_t bytes) {
+        size_t mappedBytes = bytes + HUGE_PAGE_SIZE;
+        void* mapped = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED) {
+            return nullptr;
+        }
+
+        uintptr_t start = reinterpret_cast<uintptr_t>(mapped);
+        uintptr_t alignedStart = roundUp(start, HUGE_PAGE_SIZE);
+        size_t headBytes = alignedStart - start;
+        size_t tailBytes = mappedBytes - headBytes - bytes;
+        if (headBytes > 0) {
+            munmap(mapped, headBytes);
+        }
+        if (tailBytes > 0) {
+            munmap(reinterpret_cast<void*>(alignedStart + bytes), tailBytes);
+        }
+        return reinterpret_cast<void*>(alignedStart);
+    }
+}
+
+void setLargeAllocationPolicy(const LargeAllocationPolicy& policy) {
+    std::lock_guard<std::mutex> lock(policyMutex);
+    currentPolicy = policy;
+}
+
+LargeAllocationPolicy getLargeAllocationPolicy() {
+    std::lock_guard<std::mutex> lock(policyMutex);
+    return currentPolicy;
+}
+
+void* allocateAligned(size_t bytes) {
+    if (bytes == 0) {
+        bytes = 1;
+    }
+
+    if (bytes < HUGE_PAGE_SIZE) {
+        // aligned_alloc wants the size to be a multiple of the alignment
+        void* block = std::aligned_alloc(CACHE_LINE_SIZE, roundUp(bytes, CACHE_LINE_SIZE));
+        if (!block) {
+            throw std::bad_alloc();
+        }
+        return block;
+    }
+
+    LargeAllocationPolicy policy = getLargeAllocationPolicy();
+    size_t mappedBytes = roundUp(bytes, HUGE_PAGE_SIZE);
+
+    // Reserved huge pages are guaranteed, but the pool is usually empty - fall back quietly
+    void* block = policy.explicitHugePages ? mapExplicitHugePages(mappedBytes) : nullptr;
+    if (!block) {
+        block = mapAligned(mappedBytes);
+        if (!block) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if (policy.transparentHugePages) {
+            madvise(block, mappedBytes, MADV_HUGEPAGE);   // Only a hint - fine if THP is off
+        }
+#endif
+    }
+
+    if (policy.prefaultThreads > 0) {
+        prefaultPages(block, mappedBytes, policy.prefaultThreads);
+    }
+    return block;
+}
+
+void deallocateAligned(void* block, size_t bytes) noexcept {
+    if (!block) {
+        return;
+    }
+
+    if (bytes == 0) {
+        bytes = 1;
+    }
+
+    // The size decides which way the block was allocated, same as in allocateAligned
+    if (bytes < HUGE_PAGE_SIZE) {
+        std::free(block);
+    } else {
+        munmap(block, roundUp(bytes, HUGE_PAGE_SIZE));
+    }
+}
+
+void prefaultPages(void* block, size_t bytes, unsigned int threads) {
+    static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t pageCount = (bytes + pageSize - 1) / pageSize;
+    volatile unsigned char* bytesStart = static_cast<unsigned char*>(block);
+
+    auto touchPages = [=](size_t firstPage, size_t endPage) {
+        for (size_t page = firstPage; page < endPage; ++page) {
+            bytesStart[page * pageSize] = 0;
+        }
+    };
+
+    // Not worth starting threads for a handful of pages
+    threads = static_cast<unsigned int>(std::min<size_t>(std::max(threads, 1u), pageCount / 256 + 1));
+    if (threads <= 1) {
+        touchPages(0, pageCount);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    size_t pagesPerThread = (pageCount + threads - 1) / threads;
+    for (unsigned int i = 1; i < threads; ++i) {
+        size_t firstPage = std::min(pageCount, i * pagesPerThread);
+        size_t endPage = std::min(pageCount, firstPage + pagesPerThread);
+        workers.emplace_back(touchPages, firstPage, endPage);
+    }
+    touchPages(0, std::min(pageCount, pagesPerThread));
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file
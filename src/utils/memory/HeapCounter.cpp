@@ -0,0 +1,100 @@
+/**
+ * @file HeapCounter.cpp
+ * @brief Replacement global operator new/delete that can count calls
+ *
+ * Every form of operator new goes through allocate() below and every
+ * form of delete through free(), so sized, array, nothrow and aligned
+ * versions all agree on where memory comes from.
+ */
+
+#include "../../../include/utils/memory/HeapCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace ImageCompression {
+namespace Utils {
+
+namespace {
+    std::atomic<bool> counting{false};
+    std::atomic<size_t> allocationCount{0};
+
+    void* allocate(size_t size, size_t alignment) {
+        if (counting.load(std::memory_order_relaxed)) {
+            allocationCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (size == 0) size = 1;
+
+        while (true) {
+            void* block = nullptr;
+            if (alignment <= alignof(std::max_align_t)) {
+                block = std::malloc(size);
+            } else if (posix_memalign(&block, alignment, size) != 0) {
+                block = nullptr;
+            }
+            if (block) return block;
+
+            // Same as the standard operator new: let the handler free something up, or give up
+            std::new_handler handler = std::get_new_handler();
+            if (!handler) throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void* allocateNoThrow(size_t size, size_t alignment) noexcept {
+        try {
+            return allocate(size, alignment);
+        } catch (...) {
+            return nullptr;
+        }
+    }
+}
+
+HeapAllocationCount::HeapAllocationCount() {
+    counting.store(true, std::memory_order_relaxed);
+    start_ = allocationCount.load();
+}
+
+HeapAllocationCount::~HeapAllocationCount() {
+    counting.store(false, std::memory_order_relaxed);
+}
+
+size_t HeapAllocationCount::count() const {
+    return allocationCount.load() - start_;
+}
+
+} // namespace Utils
+} // namespace ImageCompression
+
+using ImageCompression::Utils::allocate;
+using ImageCompression::Utils::allocateNoThrow;
+
+void* operator new(std::size_t size) { return allocate(size, 0); }
+void* operator new[](std::size_t size) { return allocate(size, 0); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return allocateNoThrow(size, 0); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return allocateNoThrow(size, 0); }
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return allocate(size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return allocate(size, static_cast<std::size_t>(alignment));
+}
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateNoThrow(size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateNoThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* block) noexcept { std::free(block); }
+void operator delete[](void* block) noexcept { std::free(block); }
+void operator delete(void* block, std::size_t) noexcept { std::free(block); }
+void operator delete[](void* block, std::size_t) noexcept { std::free(block); }
+void operator delete(void* block, const std::nothrow_t&) noexcept { std::free(block); }
+void operator delete[](void* block, const std::nothrow_t&) noexcept { std::free(block); }
+void operator delete(void* block, std::align_val_t) noexcept { std::free(block); }
+void operator delete[](void* block, std::align_val_t) noexcept { std::free(block); }
+void operator delete(void* block, std::size_t, std::align_val_t) noexcept { std::free(block); }
+void operator delete[](void* block, std::size_t, std::align_val_t) noexcept { std::free(block); }
+void operator delete(void* block, std::align_val_t, const std::nothrow_t&) noexcept { std::free(block); }
+void operator delete[](void* block, std::align_val_t, const std::nothrow_t&) noexcept { std::free(block); }
\ No newline at end of file
@@ -0,0 +1,137 @@
+/**
+ * @file MemoryAccounting.cpp
+ * @brief Per-thread memory counters
+ *
+ * Plain thread-local numbers, so recording costs a few adds and no atomics.
+ * A buffer freed on another thread than it was allocated on just makes that
+ * thread's current count dip, which is why the counts are signed.
+ */
+
+#include "../../../include/utils/memory/MemoryAccounting.h"
+#include <algorithm>
+#include <sys/resource.h>
+
+namespace ImageCompression {
+namespace Utils {
+
+namespace {
+    struct ThreadCounters {
+        int64_t currentBytes[MEMORY_OWNER_COUNT] = {};
+        int64_t currentTotal = 0;
+        int64_t peakBytes[MEMORY_OWNER_COUNT] = {};
+        int64_t peakTotal = 0;
+        size_t allocations[MEMORY_OWNER_COUNT] = {};
+        int openScopes = 0;
+    };
+
+    thread_local ThreadCounters counters;
+}
+
+const char* memoryOwnerName(MemoryOwner owner) {
+    switch (owner) {
+        case MemoryOwner::PngPixels:        return "pixels";
+        case MemoryOwner::StatisticsTables: return "statistics";
+        case MemoryOwner::TreeNodes:        return "tree";
+        case MemoryOwner::CodecBuffers:     return "codec";
+        case MemoryOwner::Other:            return "other";
+    }
+    return "unknown";
+}
+
+void recordAllocation(MemoryOwner owner, size_t bytes) {
+    size_t index = static_cast<size_t>(owner);
+    int64_t amount = static_cast<int64_t>(bytes);
+
+    counters.currentBytes[index] += amount;
+    counters.currentTotal += amount;
+    counters.peakBytes[index] = std::max(counters.peakBytes[index], counters.currentBytes[index]);
+    counters.peakTotal = std::max(counters.peakTotal, counters.currentTotal);
+    counters.allocations[index]++;
+}
+
+void recordRelease(MemoryOwner owner, size_t bytes) {
+    size_t index = static_cast<size_t>(owner);
+    int64_t amount = static_cast<int64_t>(bytes);
+
+    counters.currentBytes[index] -= amount;
+    counters.currentTotal -= amount;
+}
+
+MemoryUsageScope::MemoryUsageScope() {
+    if (counters.openScopes++ > 0) {
+        return;
+    }
+
+    // New measurement - peaks start from what's already held
+    for (size_t i = 0; i < MEMORY_OWNER_COUNT; ++i) {
+        counters.peakBytes[i] = counters.currentBytes[i];
+        counters.allocations[i] = 0;
+    }
+    counters.peakTotal = counters.currentTotal;
+}
+
+MemoryUsageScope::~MemoryUsageScope() {
+    counters.openScopes--;
+}
+
+MemoryUsage MemoryUsageScope::usage() const {
+    MemoryUsage usage;
+    usage.peakBytes = static_cast<size_t>(std::max<int64_t>(0, counters.peakTotal));
+    for (size_t i = 0; i < MEMORY_OWNER_COUNT; ++i) {
+        usage.peakBytesByOwner[i] = static_cast<size_t>(std::max<int64_t>(0, counters.peakBytes[i]));
+        usage.allocationsByOwner[i] = counters.allocations[i];
+    }
+    return usage;
+}
+
+MemoryHandOff::MemoryHandOff() {
+    // Start from nothing, so the borrowed work can't see (or be blamed for) ours
+    for (size_t i = 0; i < MEMORY_OWNER_COUNT; ++i) {
+        currentBytes_[i] = counters.currentBytes[i];
+        peakBytes_[i] = counters.peakBytes[i];
+        allocations_[i] = counters.allocations[i];
+    }
+    currentTotal_ = counters.currentTotal;
+    peakTotal_ = counters.peakTotal;
+    openScopes_ = counters.openScopes;
+    counters = ThreadCounters();
+}
+
+MemoryDelta MemoryHandOff::finish() {
+    MemoryDelta delta;
+    for (size_t i = 0; i < MEMORY_OWNER_COUNT; ++i) {
+        delta.bytes[i] = counters.currentBytes[i];
+        delta.allocations[i] = counters.allocations[i];
+
+        counters.currentBytes[i] = currentBytes_[i];
+        counters.peakBytes[i] = peakBytes_[i];
+        counters.allocations[i] = allocations_[i];
+    }
+    counters.currentTotal = currentTotal_;
+    counters.peakTotal = peakTotal_;
+    counters.openScopes = openScopes_;
+    return delta;
+}
+
+void absorbMemory(const MemoryDelta& delta) {
+    // The helpers' own high points are lost - only what they still hold lands here
+    for (size_t i = 0; i < MEMORY_OWNER_COUNT; ++i) {
+        counters.currentBytes[i] += delta.bytes[i];
+        counters.currentTotal += delta.bytes[i];
+        counters.peakBytes[i] = std::max(counters.peakBytes[i], counters.currentBytes[i]);
+        counters.allocations[i] += delta.allocations[i];
+    }
+    counters.peakTotal = std::max(counters.peakTotal, counters.currentTotal);
+}
+
+size_t getPeakResidentBytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    // Linux reports kilobytes
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file
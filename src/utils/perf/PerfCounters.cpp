@@ -0,0 +1,195 @@
+/**
+ * @file PerfCounters.cpp
+ * @brief perf_event_open backed counters
+ *
+ * Every event is opened on its own rather than as a group, so a machine
+ * missing one event (VMs often hide the TLB counters) still gets the
+ * others. Counters run from when a thread opens them; stages are measured
+ * by taking the difference of two readings.
+ */
+
+#include "../../../include/utils/perf/PerfCounters.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <system_error>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace ImageCompression {
+namespace Utils {
+
+namespace {
+    std::atomic<bool> countingEnabled(false);
+
+    std::mutex reasonMutex;
+    std::string unavailableReason;
+
+    void noteUnavailable(const std::string& reason) {
+        std::lock_guard<std::mutex> lock(reasonMutex);
+        if (unavailableReason.empty()) {
+            unavailableReason = reason;
+        }
+    }
+
+#ifdef __linux__
+    struct EventSpec {
+        uint32_t type;
+        uint64_t config;
+    };
+
+    const EventSpec EVENT_SPECS[PERF_EVENT_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}
+    };
+
+    // One thread's open counters - closed when the thread exits
+    class ThreadCounters {
+    public:
+        ThreadCounters() {
+            for (size_t i = 0; i < PERF_EVENT_COUNT; ++i) {
+                descriptors_[i] = open(EVENT_SPECS[i]);
+            }
+        }
+
+        ~ThreadCounters() {
+            for (int descriptor : descriptors_) {
+                if (descriptor >= 0) close(descriptor);
+            }
+        }
+
+        PerfCounterValues read() const {
+            PerfCounterValues values;
+            for (size_t i = 0; i < PERF_EVENT_COUNT; ++i) {
+                if (descriptors_[i] < 0) continue;
+
+                // value, time enabled, time running
+                uint64_t reading[3];
+                if (::read(descriptors_[i], reading, sizeof(reading)) != sizeof(reading)) continue;
+
+                // The kernel multiplexes when there are more events than hardware counters
+                double scale = reading[2] > 0 ? static_cast<double>(reading[1]) / reading[2] : 1.0;
+                values.counts[i] = static_cast<uint64_t>(reading[0] * scale);
+                values.available[i] = true;
+            }
+            return values;
+        }
+
+    private:
+        int descriptors_[PERF_EVENT_COUNT];
+
+        static int open(const EventSpec& spec) {
+            struct perf_event_attr attributes;
+            std::memset(&attributes, 0, sizeof(attributes));
+            attributes.size = sizeof(attributes);
+            attributes.type = spec.type;
+            attributes.config = spec.config;
+            attributes.exclude_kernel = 1;   // Lets it work with perf_event_paranoid up to 2
+            attributes.exclude_hv = 1;
+            attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            long descriptor = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+            if (descriptor < 0) {
+                noteUnavailable(errno == ENOENT || errno == EOPNOTSUPP
+                                ? "event not supported by this CPU or VM"
+                                : errno == EACCES || errno == EPERM
+                                ? "permission denied (see /proc/sys/kernel/perf_event_paranoid)"
+                                : "perf_event_open failed: " + std::system_category().message(errno));
+                return -1;
+            }
+            return static_cast<int>(descriptor);
+        }
+    };
+
+    const ThreadCounters& threadCounters() {
+        thread_local ThreadCounters counters;
+        return counters;
+    }
+#endif
+}
+
+const char* perfEventName(PerfEvent event) {
+    switch (event) {
+        case PerfEvent::Cycles:       return "cycles";
+        case PerfEvent::Instructions: return "instructions";
+        case PerfEvent::CacheMisses:  return "llc-misses";
+        case PerfEvent::DtlbMisses:   return "dtlb-misses";
+        case PerfEvent::BranchMisses: return "branch-misses";
+    }
+    return "unknown";
+}
+
+bool PerfCounterValues::any() const {
+    for (bool isAvailable : available) {
+        if (isAvailable) return true;
+    }
+    return false;
+}
+
+double PerfCounterValues::instructionsPerCycle() const {
+    if (!has(PerfEvent::Cycles) || !has(PerfEvent::Instructions) || get(PerfEvent::Cycles) == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(get(PerfEvent::Instructions)) / get(PerfEvent::Cycles);
+}
+
+PerfCounterValues PerfCounterValues::until(const PerfCounterValues& later) const {
+    PerfCounterValues difference;
+    for (size_t i = 0; i < PERF_EVENT_COUNT; ++i) {
+        difference.available[i] = available[i] && later.available[i];
+        if (difference.available[i] && later.counts[i] >= counts[i]) {
+            difference.counts[i] = later.counts[i] - counts[i];
+        }
+    }
+    return difference;
+}
+
+PerfCounterValues& PerfCounterValues::operator+=(const PerfCounterValues& other) {
+    for (size_t i = 0; i < PERF_EVENT_COUNT; ++i) {
+        counts[i] += other.counts[i];
+        available[i] = available[i] || other.available[i];
+    }
+    return *this;
+}
+
+bool enablePerfCounters() {
+    countingEnabled = true;
+#ifdef __linux__
+    return threadCounters().read().any();
+#else
+    noteUnavailable("hardware counters are only supported on Linux");
+    return false;
+#endif
+}
+
+bool perfCountersEnabled() {
+    return countingEnabled;
+}
+
+std::string perfCountersUnavailableReason() {
+    std::lock_guard<std::mutex> lock(reasonMutex);
+    return unavailableReason;
+}
+
+PerfCounterValues readPerfCounters() {
+#ifdef __linux__
+    if (countingEnabled) {
+        return threadCounters().read();
+    }
+#endif
+    return PerfCounterValues();
+}
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file
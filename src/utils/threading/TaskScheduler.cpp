@@ -0,0 +1,342 @@
+/**
+ * @file TaskScheduler.cpp
+ * @brief Work-stealing pool behind TaskGroup, parallelInvoke and parallelFor
+ *
+ * Workers are started lazily, up to getThreadLimit() - 1 of them (the
+ * thread that starts the work is the other one), and never stopped until
+ * the process exits. Lowering the limit just leaves the extra workers
+ * asleep. Each deque is an intrusive list of Tasks behind its own mutex;
+ * tasks here are coarse (whole subtrees, bands of rows, whole images), so
+ * a lock per push and pop is noise next to the work itself, and linking a
+ * task in never allocates.
+ */
+
+#include "../../../include/utils/threading/TaskScheduler.h"
+#include "../../../include/utils/threading/ThreadLimit.h"
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace ImageCompression {
+namespace Utils {
+
+namespace {
+    /// More workers than this are never started, whatever the limit says
+    constexpr unsigned int MAX_WORKERS = 255;
+
+    /// Owns its function, for TaskGroup::run(std::function) - deletes itself once it has run
+    class OwnedFunctionTask : public Task {
+    public:
+        explicit OwnedFunctionTask(std::function<void()> work) : work_(std::move(work)) {}
+
+    protected:
+        void execute() override { work_(); }
+        void finished() override { delete this; }
+
+    private:
+        std::function<void()> work_;
+    };
+
+    /// Index of the worker running on this thread (-1 for threads we didn't start)
+    thread_local int workerIndex = -1;
+}
+
+/**
+ * @brief The process-wide pool
+ */
+class TaskScheduler {
+public:
+    static TaskScheduler& instance() {
+        static TaskScheduler scheduler;
+        return scheduler;
+    }
+
+    ~TaskScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            stopping_ = true;
+        }
+        wakeUp_.notify_all();
+        for (unsigned int i = 0; i < startedWorkers_; ++i) {
+            threads_[i].join();
+        }
+    }
+
+    void submit(Task& task) {
+        unsigned int wanted = std::min(getThreadLimit() - 1, MAX_WORKERS);
+        if (startedWorkers_.load(std::memory_order_acquire) < wanted) {
+            startWorkers(wanted);
+        }
+
+        // Workers keep what they spawn close; everyone else goes through the shared queue.
+        // It's counted before it's visible, so a thief can never take the count below zero.
+        TaskQueue& queue = workerIndex >= 0 ? queues_[workerIndex] : injected_;
+        queued_.fetch_add(1);
+        pushBack(queue, task);
+
+        // Everyone hears about it: a single wake-up could land on a worker that's over the
+        // limit, or on a joiner that isn't allowed to take this task, and then nobody would
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            generation_++;
+        }
+        wakeUp_.notify_all();
+        joinWake_.notify_all();
+    }
+
+    /// Run one queued task if there is one - own deque first, then the shared queue, then steal.
+    /// A thread waiting on a group only takes what that wait could be held up by (see takeTask).
+    bool runOne(const TaskGroup* waitingFor) {
+        Task* task = takeTask(waitingFor);
+        if (!task) {
+            return false;
+        }
+        execute(*task, true);
+        return true;
+    }
+
+    /// Bumped every time a task is queued, so a joiner knows whether it's worth looking again
+    size_t generation() const {
+        return generation_.load();
+    }
+
+    /// Sleep until the group has finished or something new has been queued since `seen`
+    void waitForChange(const TaskGroup& group, size_t seen) {
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        joinWake_.wait(lock, [&]() {
+            return group.pending_.load(std::memory_order_acquire) == 0 || generation_.load() != seen;
+        });
+    }
+
+    /// A group just finished its last task - let whoever is waiting on it go
+    void groupFinished() {
+        { std::lock_guard<std::mutex> lock(sleepMutex_); }
+        joinWake_.notify_all();
+    }
+
+    // Queued tasks run with their own memory counters, handed to the group when they finish:
+    // whichever thread picks one up, even one in the middle of another task, it's counted
+    // against the thread that waits on the group. Inline tasks just count where they run.
+    static void execute(Task& task, bool queued) {
+        TaskGroup& group = *task.group_;
+
+        std::exception_ptr error;
+        MemoryDelta helperMemory;
+        if (queued) {
+            MemoryHandOff handOff;
+            error = runTask(task);
+            helperMemory = handOff.finish();
+        } else {
+            error = runTask(task);
+        }
+
+        if (queued || error) {
+            std::lock_guard<std::mutex> lock(group.resultMutex_);
+            if (queued) group.helperMemory_ += helperMemory;
+            if (error && !group.error_) group.error_ = error;
+        }
+        // The group may be gone as soon as the count reaches zero, so nothing touches it after
+        if (group.pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            instance().groupFinished();
+        }
+    }
+
+private:
+    /// A deque of tasks linked through the tasks themselves
+    struct TaskQueue {
+        std::mutex mutex;
+        Task* head = nullptr;   ///< Oldest
+        Task* tail = nullptr;   ///< Newest
+    };
+
+    std::unique_ptr<TaskQueue[]> queues_;
+    std::unique_ptr<std::thread[]> threads_;
+    std::atomic<unsigned int> startedWorkers_{0};
+    std::mutex startMutex_;
+    TaskQueue injected_;
+
+    std::atomic<size_t> queued_{0};   // Tasks sitting in any queue
+    std::atomic<size_t> generation_{0};
+    std::mutex sleepMutex_;
+    std::condition_variable wakeUp_;     // Idle workers
+    std::condition_variable joinWake_;   // Threads waiting on a group
+    bool stopping_ = false;
+
+    TaskScheduler()
+        : queues_(new TaskQueue[MAX_WORKERS]), threads_(new std::thread[MAX_WORKERS]) {}
+
+    void startWorkers(unsigned int wanted) {
+        std::lock_guard<std::mutex> lock(startMutex_);
+        unsigned int started = startedWorkers_.load();
+        for (; started < wanted; ++started) {
+            threads_[started] = std::thread(&TaskScheduler::workerLoop, this, started);
+        }
+        startedWorkers_.store(started, std::memory_order_release);
+    }
+
+    // Whatever the task captured goes before the group hears it's done
+    static std::exception_ptr runTask(Task& task) {
+        std::exception_ptr error;
+        try {
+            task.execute();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        task.finished();
+        return error;
+    }
+
+    static void pushBack(TaskQueue& queue, Task& task) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        task.previous_ = queue.tail;
+        task.next_ = nullptr;
+        if (queue.tail) queue.tail->next_ = &task;
+        else queue.head = &task;
+        queue.tail = &task;
+    }
+
+    // Caller holds the queue's lock
+    static Task* unlink(TaskQueue& queue, Task* task) {
+        if (task->previous_) task->previous_->next_ = task->next_;
+        else queue.head = task->next_;
+        if (task->next_) task->next_->previous_ = task->previous_;
+        else queue.tail = task->previous_;
+        task->previous_ = task->next_ = nullptr;
+        return task;
+    }
+
+    static Task* popBack(TaskQueue& queue) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        return queue.tail ? unlink(queue, queue.tail) : nullptr;
+    }
+
+    static Task* popFront(TaskQueue& queue) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        return queue.head ? unlink(queue, queue.head) : nullptr;
+    }
+
+    // Take the newest task whose group matches from the shared queue. Files in a batch sit at
+    // the front, and a thread's own subtasks are pushed after them, so look at the front
+    // first (a batch waits on its files in order) and then from the back.
+    static Task* takeInjected(TaskQueue& queue, const TaskGroup* group) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.head && queue.head->group_ == group) {
+            return unlink(queue, queue.head);
+        }
+        for (Task* task = queue.tail; task; task = task->previous_) {
+            if (task->group_ == group) return unlink(queue, task);
+        }
+        return nullptr;
+    }
+
+    // A worker with nothing on its stack takes anything. A thread waiting on a group only
+    // takes its own subtasks and steals other workers' subtasks - never a task from the shared
+    // queue that belongs to someone else, which would start a whole new image underneath the
+    // one it's in the middle of, keep that one from finishing and take its memory with it.
+    Task* takeTask(const TaskGroup* waitingFor) {
+        if (queued_.load() == 0) {
+            return nullptr;
+        }
+
+        Task* task = workerIndex >= 0 ? popBack(queues_[workerIndex]) : nullptr;
+        if (!task && !waitingFor) {
+            task = popFront(injected_);
+        } else if (!task && workerIndex < 0) {
+            // Only threads we didn't start have anything of their own in the shared queue
+            task = takeInjected(injected_, waitingFor);
+        }
+
+        // Steal the oldest task from someone else, starting just past ourselves so
+        // thieves don't all pile onto worker 0
+        unsigned int workers = startedWorkers_.load(std::memory_order_acquire);
+        unsigned int start = workerIndex >= 0 ? static_cast<unsigned int>(workerIndex) + 1 : 0;
+        for (unsigned int i = 0; !task && i < workers; ++i) {
+            unsigned int victim = (start + i) % workers;
+            if (static_cast<int>(victim) != workerIndex) {
+                task = popFront(queues_[victim]);
+            }
+        }
+
+        if (task) queued_.fetch_sub(1);
+        return task;
+    }
+
+    // Only the first getThreadLimit() - 1 workers take tasks; the rest sleep until it goes up again
+    static bool allowedToWork(unsigned int index) {
+        return index + 1 < getThreadLimit();
+    }
+
+    void workerLoop(unsigned int index) {
+        workerIndex = static_cast<int>(index);
+
+        while (true) {
+            if (allowedToWork(index) && runOne(nullptr)) {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            wakeUp_.wait(lock, [&]() {
+                return stopping_ || (queued_.load() > 0 && allowedToWork(index));
+            });
+            if (stopping_) return;
+        }
+    }
+};
+
+TaskGroup::TaskGroup() : pending_(0) {}
+
+TaskGroup::~TaskGroup() {
+    waitForTasks();
+}
+
+void TaskGroup::run(Task& task) {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    task.group_ = this;
+
+    // Nobody to share with - just do it now
+    if (getThreadLimit() <= 1) {
+        TaskScheduler::execute(task, false);
+        return;
+    }
+    TaskScheduler::instance().submit(task);
+}
+
+void TaskGroup::run(std::function<void()> task) {
+    run(*new OwnedFunctionTask(std::move(task)));
+}
+
+void TaskGroup::waitForTasks() {
+    // Help out rather than block - the task we're waiting for may be sitting in our own
+    // deque - and sleep when there's nothing we're allowed to take
+    TaskScheduler& scheduler = TaskScheduler::instance();
+    while (pending_.load(std::memory_order_acquire) > 0) {
+        size_t seen = scheduler.generation();
+        if (!scheduler.runOne(this)) {
+            scheduler.waitForChange(*this, seen);
+        }
+    }
+}
+
+void TaskGroup::wait() {
+    waitForTasks();
+
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(resultMutex_);
+        absorbMemory(helperMemory_);
+        helperMemory_ = MemoryDelta();
+        std::swap(error, error_);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+unsigned int parallelism() {
+    return getThreadLimit();
+}
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file
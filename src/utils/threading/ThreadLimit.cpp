@@ -0,0 +1,32 @@
+/**
+ * @file ThreadLimit.cpp
+ * @brief Process-wide thread cap
+ */
+
+#include "../../../include/utils/threading/ThreadLimit.h"
+#include <atomic>
+#include <thread>
+
+namespace ImageCompression {
+namespace Utils {
+
+namespace {
+    std::atomic<unsigned int> threadLimit(0);   // 0 = not set, use the hardware count
+}
+
+unsigned int hardwareThreadCount() {
+    unsigned int count = std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+}
+
+void setThreadLimit(unsigned int threads) {
+    threadLimit = threads;
+}
+
+unsigned int getThreadLimit() {
+    unsigned int limit = threadLimit;
+    return limit > 0 ? limit : hardwareThreadCount();
+}
+
+} // namespace Utils
+} // namespace ImageCompression
\ No newline at end of file